@@ -0,0 +1,394 @@
+#ifndef BN_H
+#define BN_H
+
+#include <linux/err.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+/*
+ * arbitrary-precision integer shared by all backends
+ * number[size - 1] = most significant limb, number[0] = least significant limb
+ * the radix of a limb is up to the backend (2^32 in bn2.h, 10^8 in bn10.h)
+ */
+typedef struct _bn {
+    unsigned int *number;
+    unsigned int size;
+    unsigned int capacity; /* limbs allocated for number */
+    int sign;
+} bn;
+
+/*
+ * receives the decimal string of a number block by block, most significant
+ * first; return 0 for more, > 0 to stop early, < 0 to abort with that error
+ */
+typedef int (*bn_sink_t)(void *arg, const char *s, size_t len);
+
+/*
+ * arithmetic that depends on the radix of the limbs
+ * add, sub and mult return 0 on success or -ENOMEM / -EINTR, leaving c
+ * unspecified; to_string returns a string from bn_pool_get(), whose size in
+ * bytes goes to *size, or an ERR_PTR() on error
+ * add and sub work in place, mult needs c distinct from a and b (-EINVAL)
+ */
+struct bn_ops {
+    const char *name;
+    int (*add)(const bn *a, const bn *b, bn *c);
+    int (*sub)(const bn *a, const bn *b, bn *c);
+    int (*mult)(const bn *a, const bn *b, bn *c);
+    char *(*to_string)(bn *src, size_t *size);
+    /* a backend has render or emit for read() */
+    /* piecewise decimal output, see bn10_render() */
+    size_t (*str_len)(const bn *src);
+    size_t (*render)(const bn *src, char *dst, size_t off, size_t len);
+    /* decimal output in blocks to sink, see bn2_emit() */
+    int (*emit)(const bn *src, bn_sink_t sink, void *arg);
+};
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#ifndef SWAP
+#define SWAP(x, y)           \
+    do {                     \
+        typeof(x) __tmp = x; \
+        x = y;               \
+        y = __tmp;           \
+    } while (0)
+#endif
+
+#ifndef DIV_ROUNDUP
+#define DIV_ROUNDUP(x, len) (((x) + (len) -1) / (len))
+#endif
+
+/*
+ * called from long loops: give up the CPU if another task needs it
+ * return 0 to go on, -EINTR when the caller has been killed
+ */
+static inline int bn_yield(void)
+{
+    cond_resched();
+    return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/*
+ * per-CPU pools of free buffers for limbs and rendered output
+ * freed buffers stay on the CPU that freed them, the next request there
+ * takes the best fit instead of going back to kvmalloc; only the shrinker
+ * touches another CPU's pool, so the locks are uncontended
+ * a pool holds at most BN_POOL_CPU_BYTES, making room by freeing its oldest
+ * buffers, and buffers idle for BN_POOL_AGE are freed on the next put
+ */
+#define BN_POOL_SLOTS 8
+/* larger buffers are one-offs, they go straight back to kvfree */
+#define BN_POOL_MAX_BYTES (1UL << 20)
+#define BN_POOL_CPU_BYTES (4UL << 20)
+#define BN_POOL_AGE HZ
+
+struct bn_pool {
+    spinlock_t lock;
+    unsigned int count;
+    size_t bytes; /* sum of slot[].size */
+    struct {
+        void *buf;
+        size_t size;
+        unsigned long stamp; /* jiffies when it was put */
+    } slot[BN_POOL_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct bn_pool, bn_pools);
+
+/*
+ * a buffer of at least size bytes, its real size goes to *got
+ * a pooled buffer is only taken if at most twice as large as needed
+ * return NULL on error
+ */
+static void *bn_pool_get(size_t size, size_t *got)
+{
+    struct bn_pool *pool = raw_cpu_ptr(&bn_pools);
+    void *buf = NULL;
+    int best = -1;
+
+    spin_lock(&pool->lock);
+    for (int i = 0; i < pool->count; i++) {
+        if (pool->slot[i].size >= size && pool->slot[i].size / 2 <= size &&
+            (best < 0 || pool->slot[i].size < pool->slot[best].size))
+            best = i;
+    }
+    if (best >= 0) {
+        buf = pool->slot[best].buf;
+        *got = pool->slot[best].size;
+        pool->bytes -= *got;
+        pool->slot[best] = pool->slot[--pool->count];
+    }
+    spin_unlock(&pool->lock);
+    if (buf)
+        return buf;
+
+    *got = size;
+    return kvmalloc(size, GFP_KERNEL);
+}
+
+/* take slot i out of pool, return its buffer */
+static void *bn_pool_take(struct bn_pool *pool, int i)
+{
+    void *buf = pool->slot[i].buf;
+
+    pool->bytes -= pool->slot[i].size;
+    pool->slot[i] = pool->slot[--pool->count];
+    return buf;
+}
+
+/* give back a buffer of size bytes from bn_pool_get(), NULL is ignored */
+static void bn_pool_put(void *buf, size_t size)
+{
+    struct bn_pool *pool = raw_cpu_ptr(&bn_pools);
+    void *old[BN_POOL_SLOTS];
+    int nr_old = 0;
+
+    if (!buf)
+        return;
+    if (size > BN_POOL_MAX_BYTES) {
+        kvfree(buf);
+        return;
+    }
+
+    spin_lock(&pool->lock);
+    for (int i = pool->count - 1; i >= 0; i--) {
+        if (time_after(jiffies, pool->slot[i].stamp + BN_POOL_AGE))
+            old[nr_old++] = bn_pool_take(pool, i);
+    }
+    /* make room by dropping the oldest buffers */
+    while (pool->count == BN_POOL_SLOTS ||
+           pool->bytes + size > BN_POOL_CPU_BYTES) {
+        int oldest = 0;
+        for (int i = 1; i < pool->count; i++) {
+            if (time_before(pool->slot[i].stamp, pool->slot[oldest].stamp))
+                oldest = i;
+        }
+        old[nr_old++] = bn_pool_take(pool, oldest);
+    }
+    pool->slot[pool->count].buf = buf;
+    pool->slot[pool->count].size = size;
+    pool->slot[pool->count++].stamp = jiffies;
+    pool->bytes += size;
+    spin_unlock(&pool->lock);
+
+    while (nr_old)
+        kvfree(old[--nr_old]);
+}
+
+/* free at least nr pages held by the pools, return the pages freed */
+static unsigned long bn_pool_drain(unsigned long nr)
+{
+    size_t freed = 0;
+    int cpu;
+
+    for_each_possible_cpu (cpu) {
+        struct bn_pool *pool = per_cpu_ptr(&bn_pools, cpu);
+
+        while (freed / PAGE_SIZE < nr) {
+            void *buf = NULL;
+            spin_lock(&pool->lock);
+            if (pool->count) {
+                freed += pool->slot[pool->count - 1].size;
+                buf = bn_pool_take(pool, pool->count - 1);
+            }
+            spin_unlock(&pool->lock);
+            if (!buf)
+                break;
+            kvfree(buf);
+        }
+    }
+    return DIV_ROUND_UP(freed, PAGE_SIZE);
+}
+
+static unsigned long bn_pool_count(struct shrinker *s,
+                                   struct shrink_control *sc)
+{
+    unsigned long bytes = 0;
+    int cpu;
+
+    for_each_possible_cpu (cpu)
+        bytes += READ_ONCE(per_cpu_ptr(&bn_pools, cpu)->bytes);
+    return bytes ? DIV_ROUND_UP(bytes, PAGE_SIZE) : SHRINK_EMPTY;
+}
+
+static unsigned long bn_pool_scan(struct shrinker *s,
+                                  struct shrink_control *sc)
+{
+    return bn_pool_drain(sc->nr_to_scan);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *bn_pool_shrinker;
+#else
+static struct shrinker bn_pool_shrinker_s = {
+    .count_objects = bn_pool_count,
+    .scan_objects = bn_pool_scan,
+    .seeks = DEFAULT_SEEKS,
+};
+static struct shrinker *bn_pool_shrinker = &bn_pool_shrinker_s;
+#endif
+
+/* return 0 on success, -ENOMEM on error */
+int bn_pool_init(void)
+{
+    int cpu;
+
+    for_each_possible_cpu (cpu)
+        spin_lock_init(&per_cpu_ptr(&bn_pools, cpu)->lock);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    bn_pool_shrinker = shrinker_alloc(0, "fibdrv-bn-pool");
+    if (!bn_pool_shrinker)
+        return -ENOMEM;
+    bn_pool_shrinker->count_objects = bn_pool_count;
+    bn_pool_shrinker->scan_objects = bn_pool_scan;
+    shrinker_register(bn_pool_shrinker);
+    return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    return register_shrinker(bn_pool_shrinker, "fibdrv-bn-pool");
+#else
+    return register_shrinker(bn_pool_shrinker);
+#endif
+}
+
+void bn_pool_exit(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    shrinker_free(bn_pool_shrinker);
+#else
+    unregister_shrinker(bn_pool_shrinker);
+#endif
+    bn_pool_drain(ULONG_MAX);
+}
+
+int bn_free(bn *src)
+{
+    if (src == NULL)
+        return -1;
+    bn_pool_put(src->number, sizeof(unsigned int) * src->capacity);
+    kfree(src);
+    return 0;
+}
+
+/*
+ * limbs come from the pools above, or kvmalloc, so huge numbers fall back to
+ * vmalloc instead of failing on fragmented memory
+ * return NULL on error
+ */
+bn *bn_alloc(unsigned int n)
+{
+    bn *b = kmalloc(sizeof(bn), GFP_KERNEL);
+    size_t got;
+
+    if (!b)
+        return NULL;
+    b->number = bn_pool_get(sizeof(unsigned int) * n, &got);
+    if (!b->number) {
+        kfree(b);
+        return NULL;
+    }
+    memset(b->number, 0, sizeof(unsigned int) * n);
+    b->size = n;
+    b->capacity = got / sizeof(unsigned int);
+    b->sign = 0;
+    return b;
+}
+
+/*
+ * new limbs are zeroed, shrinking keeps the allocation and never fails
+ * return 0 on success, -ENOMEM on error with src unchanged
+ */
+int bn_resize(bn *src, unsigned int size)
+{
+    if (size > src->capacity) {
+        size_t got;
+        unsigned int *number = bn_pool_get(sizeof(unsigned int) * size, &got);
+        if (!number)
+            return -ENOMEM;
+        memcpy(number, src->number, sizeof(unsigned int) * src->size);
+        bn_pool_put(src->number, sizeof(unsigned int) * src->capacity);
+        src->number = number;
+        src->capacity = got / sizeof(unsigned int);
+    }
+    for (unsigned int i = src->size; i < size; i++)
+        src->number[i] = 0;
+    src->size = size;
+
+    return 0;
+}
+
+/*
+ * set src to size zero limbs, discarding the old value: unlike bn_resize()
+ * a growing buffer is not copied over first
+ * return 0 on success, -ENOMEM on error with src unchanged
+ */
+int bn_zero(bn *src, unsigned int size)
+{
+    if (size > src->capacity) {
+        size_t got;
+        unsigned int *number = bn_pool_get(sizeof(unsigned int) * size, &got);
+        if (!number)
+            return -ENOMEM;
+        bn_pool_put(src->number, sizeof(unsigned int) * src->capacity);
+        src->number = number;
+        src->capacity = got / sizeof(unsigned int);
+    }
+    memset(src->number, 0, sizeof(unsigned int) * size);
+    src->size = size;
+    src->sign = 0;
+    return 0;
+}
+
+/*
+ * copy the value from src to dest
+ * return 0 on success, -ENOMEM on error
+ */
+int bn_cpy(bn *dest, bn *src)
+{
+    if (bn_resize(dest, src->size) < 0)
+        return -ENOMEM;
+    dest->sign = src->sign;
+    memcpy(dest->number, src->number, src->size * sizeof(unsigned int));
+    return 0;
+}
+
+/*
+ * compare length
+ * return 1 if |a| > |b|
+ * return -1 if |a| < |b|
+ * return 0 if |a| = |b|
+ */
+int bn_cmp(const bn *a, const bn *b)
+{
+    if (a->size > b->size) {
+        return 1;
+    } else if (a->size < b->size) {
+        return -1;
+    } else {
+        for (int i = a->size - 1; i >= 0; i--) {
+            if (a->number[i] > b->number[i])
+                return 1;
+            if (a->number[i] < b->number[i])
+                return -1;
+        }
+        return 0;
+    }
+}
+
+void bn_swap(bn *a, bn *b)
+{
+    bn tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+#endif /* BN_H */
@@ -1,133 +1,134 @@
-#include <linux/kernel.h>
+#ifndef BN10_H
+#define BN10_H
+
+/* bn backend with limbs in radix 10^8, MAX_DIGITS decimal digits per limb */
+#include "bn.h"
 
 #define MAX_DIGITS 8
 #define BOUND32 100000000U
 
-typedef struct _bn {
-    unsigned int *number;
-    unsigned int size;
-    int sign;
-} bn;
-
-#define MAX(x, y) ((x) > (y) ? (x) : (y))
-#ifndef SWAP
-#define SWAP(x, y)           \
-    do {                     \
-        typeof(x) __tmp = x; \
-        x = y;               \
-        y = __tmp;           \
-    } while (0)
-#endif
+/* bytes bn10_to_string() renders between two bn_yield() */
+#define BN10_RENDER_CHUNK (4096 * MAX_DIGITS)
 
 /* count the size of number if carry */
-static int size_if_carry(const bn *src)
+static int bn10_size_if_carry(const bn *src)
 {
     return src->size + !!(src->number[src->size - 1] / (BOUND32 / 10));
 }
 
-int bn_free(bn *src)
-{
-    if (src == NULL)
-        return -1;
-    kfree(src->number);
-    kfree(src);
-    return 0;
-}
+/* "00", "01", ..., "99" */
+static const char bn10_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-bn *bn_alloc(unsigned int n)
+/* write the MAX_DIGITS digits of limb x to p, with leading zeros */
+static void bn10_put_limb(char *p, unsigned int x)
 {
-    bn *b = kmalloc(sizeof(bn), GFP_KERNEL);
-    b->size = n;
-    b->sign = 0;
-    b->number = kmalloc(sizeof(unsigned int) * n, GFP_KERNEL);
-    for (unsigned int i = 0; i < n; i++)
-        b->number[i] = 0;
-    return b;
+    /* x / 10^4 and y / 100 by reciprocal multiplication, exact in range */
+    unsigned int hi = (unsigned long long) x * 109951163 >> 40;
+    unsigned int lo = x - hi * 10000;
+    unsigned int hh = hi * 5243 >> 19, lh = lo * 5243 >> 19;
+
+    memcpy(p, bn10_digit_pairs + 2 * hh, 2);
+    memcpy(p + 2, bn10_digit_pairs + 2 * (hi - hh * 100), 2);
+    memcpy(p + 4, bn10_digit_pairs + 2 * lh, 2);
+    memcpy(p + 6, bn10_digit_pairs + 2 * (lo - lh * 100), 2);
 }
 
-int bn_resize(bn *src, unsigned int size)
+/* count the digits of the most significant limb, at least 1 */
+static unsigned int bn10_top_digits(const bn *src)
 {
-    if (size == src->size)
-        return 0;
-
-    src->number =
-        krealloc(src->number, sizeof(unsigned int) * size, GFP_KERNEL);
-    for (unsigned int i = src->size; i < size; i++)
-        src->number[i] = 0;
-    src->size = size;
+    unsigned int x = src->number[src->size - 1];
+    unsigned int d = 1;
 
-    return 0;
+    for (unsigned int p = 10; d < MAX_DIGITS && x >= p; p *= 10)
+        d++;
+    return d;
 }
 
-/*
- * copy the value from src to dest
- * return 0 on success, -1 on error
- */
-int bn_cpy(bn *dest, bn *src)
+/* length of the decimal string of src, without the NUL */
+size_t bn10_str_len(const bn *src)
 {
-    if (bn_resize(dest, src->size) < 0)
-        return -1;
-    dest->sign = src->sign;
-    memcpy(dest->number, src->number, src->size * sizeof(unsigned int));
-    return 0;
+    return !!src->sign + bn10_top_digits(src) +
+           (size_t) MAX_DIGITS * (src->size - 1);
 }
 
 /*
- * compare length
- * return 1 if |a| > |b|
- * return -1 if |a| < |b|
- * return 0 if |a| = |b|
+ * write bytes [off, off + len) of the decimal string of src to dst, so the
+ * string can be produced piecewise without materializing it
+ * return the number of bytes written, 0 once off reaches the end
  */
-int bn_cmp(const bn *a, const bn *b)
+size_t bn10_render(const bn *src, char *dst, size_t off, size_t len)
 {
-    if (a->size > b->size) {
-        return 1;
-    } else if (a->size < b->size) {
-        return -1;
-    } else {
-        for (int i = a->size - 1; i >= 0; i--) {
-            if (a->number[i] > b->number[i])
-                return 1;
-            if (a->number[i] < b->number[i])
-                return -1;
-        }
+    size_t total = bn10_str_len(src);
+    /* the sign and the top limb, then MAX_DIGITS bytes per limb */
+    size_t top = total - (size_t) MAX_DIGITS * (src->size - 1);
+    size_t sign = !!src->sign;
+    char unit[MAX_DIGITS + 1];
+
+    if (off >= total)
         return 0;
+    len = min(len, total - off);
+
+    for (size_t done = 0; done < len;) {
+        size_t pos = off + done, start, n;
+
+        if (pos < top) {
+            char limb[MAX_DIGITS];
+            bn10_put_limb(limb, src->number[src->size - 1]);
+            if (sign)
+                unit[0] = '-';
+            memcpy(unit + sign, limb + MAX_DIGITS - (top - sign), top - sign);
+            start = 0;
+            n = top;
+        } else {
+            size_t k = (pos - top) / MAX_DIGITS;
+            bn10_put_limb(unit, src->number[src->size - 2 - k]);
+            start = top + k * MAX_DIGITS;
+            n = MAX_DIGITS;
+        }
+        n = min(n - (pos - start), len - done);
+        memcpy(dst + done, unit + (pos - start), n);
+        done += n;
     }
+    return len;
 }
 
 /*
  * output bn to decimal string
- * Note: the returned string should be freed with kfree()
+ * Note: the returned string comes from bn_pool_get(), it should be given back
+ * with bn_pool_put() and the size stored in *size
+ * return ERR_PTR(-ENOMEM) or ERR_PTR(-EINTR) on error
  */
-char *bn_to_string(bn *src)
+char *bn10_to_string(bn *src, size_t *size)
 {
-    size_t len = src->size * MAX_DIGITS + 2;
-    char *s = kmalloc(len, GFP_KERNEL);
-    char *p = s + 1;
+    size_t len = bn10_str_len(src), got;
+    char *s = bn_pool_get(len + 1, &got);
 
-    memset(s, '0', len - 1);
-    s[len - 1] = '\0';
+    if (!s)
+        return ERR_PTR(-ENOMEM);
 
-    for (int i = src->size - 1; i >= 0; i--) {
-        snprintf(p, MAX_DIGITS + 1, "%08u", src->number[i]);
-        p += MAX_DIGITS;
-    }
-    // skip leading zero
-    p = s;
-    while (p[0] == '0' && p[1] != '\0') {
-        p++;
+    for (size_t off = 0; off < len; off += BN10_RENDER_CHUNK) {
+        if (bn_yield() < 0) {
+            bn_pool_put(s, got);
+            return ERR_PTR(-EINTR);
+        }
+        bn10_render(src, s + off, off, BN10_RENDER_CHUNK);
     }
-    if (src->sign)
-        *(--p) = '-';
-    memmove(s, p, strlen(p) + 1);
+    s[len] = '\0';
+    *size = got;
     return s;
 }
 
 /* |c| = |a| + |b| */
-static void bn_do_add(const bn *a, const bn *b, bn *c)
+static int bn10_do_add(const bn *a, const bn *b, bn *c)
 {
-    int d = MAX(size_if_carry(a), size_if_carry(b));
-    bn_resize(c, d);
+    int d = MAX(bn10_size_if_carry(a), bn10_size_if_carry(b));
+    if (bn_resize(c, d) < 0)
+        return -ENOMEM;
 
     unsigned int carry = 0;
     for (int i = 0; i < c->size; i++) {
@@ -140,17 +141,19 @@ static void bn_do_add(const bn *a, const bn *b, bn *c)
 
     if (!c->number[c->size - 1] && c->size > 1)
         bn_resize(c, c->size - 1);
+    return 0;
 }
 
 /*
  * |c| = |a| - |b|
  * Note: |a| > |b| must be true
  */
-static void bn_do_sub(const bn *a, const bn *b, bn *c)
+static int bn10_do_sub(const bn *a, const bn *b, bn *c)
 {
     // max digits = max(sizeof(a) + sizeof(b))
     int d = MAX(a->size, b->size);
-    bn_resize(c, d);
+    if (bn_resize(c, d) < 0)
+        return -ENOMEM;
 
     long long int carry = 0;
     for (int i = 0; i < c->size; i++) {
@@ -176,58 +179,57 @@ static void bn_do_sub(const bn *a, const bn *b, bn *c)
     }
 
     bn_resize(c, c->size - d);
+    return 0;
 }
 
 /* c = a + b
  * Note: work for c == a or c == b
  */
-void bn_add(const bn *a, const bn *b, bn *c)
+int bn10_add(const bn *a, const bn *b, bn *c)
 {
+    int sign, rc;
+
     if (a->sign == b->sign) {  // both positive or negative
-        bn_do_add(a, b, c);
-        c->sign = a->sign;
+        sign = a->sign;
+        rc = bn10_do_add(a, b, c);
     } else {          // different sign
         if (a->sign)  // let a > 0, b < 0
             SWAP(a, b);
         int cmp = bn_cmp(a, b);
         if (cmp > 0) {
             /* |a| > |b| and b < 0, hence c = a - |b| */
-            bn_do_sub(a, b, c);
-            c->sign = 0;
+            sign = 0;
+            rc = bn10_do_sub(a, b, c);
         } else if (cmp < 0) {
             /* |a| < |b| and b < 0, hence c = -(|b| - |a|) */
-            bn_do_sub(b, a, c);
-            c->sign = 1;
+            sign = 1;
+            rc = bn10_do_sub(b, a, c);
         } else {
             /* |a| == |b| */
             bn_resize(c, 1);
             c->number[0] = 0;
-            c->sign = 0;
+            sign = 0;
+            rc = 0;
         }
     }
+    c->sign = sign;
+    return rc;
 }
 
 /* c = a - b
  * Note: work for c == a or c == b
  */
-void bn_sub(const bn *a, const bn *b, bn *c)
+int bn10_sub(const bn *a, const bn *b, bn *c)
 {
-    /* xor the sign bit of b and let bn_add handle it */
+    /* xor the sign bit of b and let bn10_add handle it */
     bn tmp = *b;
     tmp.sign ^= 1;  // a - b = a + (-b)
-    bn_add(a, &tmp, c);
-}
-
-void bn_swap(bn *a, bn *b)
-{
-    bn tmp = *a;
-    *a = *b;
-    *b = tmp;
+    return bn10_add(a, &tmp, c);
 }
 
 /* c += x, starting from offset */
 
-static void bn_mult_add(bn *c, int offset, unsigned long long int x)
+static void bn10_mult_add(bn *c, int offset, unsigned long long int x)
 {
     unsigned long long int carry = 0;
     for (int i = offset; i < c->size; i++) {
@@ -242,30 +244,31 @@ static void bn_mult_add(bn *c, int offset, unsigned long long int x)
 
 /*
  * c = a x b
- * Note: work for c == a or c == b
+ * Note: c must not be a or b, so no temporary is needed
  * using the simple quadratic-time algorithm (long multiplication)
  */
-void bn_mult(const bn *a, const bn *b, bn *c)
+int bn10_mult(const bn *a, const bn *b, bn *c)
 {
     int d = a->size + b->size;
-    bn *tmp;
-    /* make it work properly when c == a or c == b */
-    if (c == a || c == b) {
-        tmp = c;  // save c
-        c = bn_alloc(d);
-    } else {
-        tmp = NULL;
-        bn_resize(c, d);
-    }
+    int sign = a->sign ^ b->sign;
 
+    if (c == a || c == b)
+        return -EINVAL;
+    if (bn_zero(c, d) < 0)
+        return -ENOMEM;
+
+    int rc = 0;
     for (int i = 0; i < a->size; i++) {
+        rc = bn_yield();
+        if (rc < 0)
+            break;
         for (int j = 0; j < b->size; j++) {
             unsigned long long int carry = 0;
             carry = (unsigned long long int) a->number[i] * b->number[j];
-            bn_mult_add(c, i + j, carry);
+            bn10_mult_add(c, i + j, carry);
         }
     }
-    c->sign = a->sign ^ b->sign;
+    c->sign = sign;
 
     d = 0;
     for (int i = c->size - 1; i > 0; i--) {
@@ -276,9 +279,17 @@ void bn_mult(const bn *a, const bn *b, bn *c)
     }
 
     bn_resize(c, c->size - d);
-
-    if (tmp) {
-        bn_cpy(tmp, c);  // restore c
-        bn_free(c);
-    }
+    return rc;
 }
+
+const struct bn_ops bn10_ops = {
+    .name = "bn10",
+    .add = bn10_add,
+    .sub = bn10_sub,
+    .mult = bn10_mult,
+    .to_string = bn10_to_string,
+    .str_len = bn10_str_len,
+    .render = bn10_render,
+};
+
+#endif /* BN10_H */
@@ -1,26 +1,13 @@
-/* number[size - 1] = msb, number[0] = lsb */
-typedef struct _bn {
-    unsigned int *number;
-    unsigned int size;
-    int sign;
-} bn;
-
-#define MAX(x, y) ((x) > (y) ? (x) : (y))
-#ifndef SWAP
-#define SWAP(x, y)           \
-    do {                     \
-        typeof(x) __tmp = x; \
-        x = y;               \
-        y = __tmp;           \
-    } while (0)
-#endif
-
-#ifndef DIV_ROUNDUP
-#define DIV_ROUNDUP(x, len) (((x) + (len) -1) / (len))
-#endif
+#ifndef BN2_H
+#define BN2_H
+
+/* bn backend with limbs in radix 2^32 */
+#include <linux/math64.h>
+
+#include "bn.h"
 
 /* count leading zeros of src*/
-static int bn_clz(const bn *src)
+static int bn2_clz(const bn *src)
 {
     int cnt = 0;
     for (int i = src->size - 1; i >= 0; i--) {
@@ -36,79 +23,37 @@ static int bn_clz(const bn *src)
 }
 
 /* count the digits of most significant bit */
-static int bn_msb(const bn *src)
-{
-    return src->size * 32 - bn_clz(src);
-}
-
-int bn_free(bn *src)
-{
-    if (src == NULL)
-        return -1;
-    kfree(src->number);
-    kfree(src);
-    return 0;
-}
-
-bn *bn_alloc(unsigned int n)
+static int bn2_msb(const bn *src)
 {
-    bn *b = kmalloc(sizeof(bn), GFP_KERNEL);
-    b->size = n;
-    b->sign = 0;
-    b->number = (unsigned int *) kmalloc(sizeof(int) * n, GFP_KERNEL);
-    for (unsigned int i = 0; i < n; i++)
-        b->number[i] = 0;
-    return b;
+    return src->size * 32 - bn2_clz(src);
 }
 
-int bn_resize(bn *src, unsigned int size)
-{
-    if (size == src->size)
-        return 0;
-
-    src->number = krealloc(src->number, sizeof(int) * size, GFP_KERNEL);
-    for (unsigned int i = src->size; i < size; i++)
-        src->number[i] = 0;
-    src->size = size;
-
-    return 0;
-}
 
 /*
- * copy the value from src to dest
- * return 0 on success, -1 on error
+ * left bit shift on bn (maximun shift 31)
+ * return 0 on success, -ENOMEM on error
  */
-int bn_cpy(bn *dest, bn *src)
+int bn2_lshift(bn *src, size_t shift)
 {
-    if (bn_resize(dest, src->size) < 0)
-        return -1;
-    dest->sign = src->sign;
-    memcpy(dest->number, src->number, src->size * sizeof(int));
-    return 0;
-}
-
-
-/* left bit shift on bn (maximun shift 31) */
-void bn_lshift(bn *src, size_t shift)
-{
-    size_t z = bn_clz(src);
+    size_t z = bn2_clz(src);
     shift %= 32;  // only handle shift within 32 bits atm
     if (!shift)
-        return;
+        return 0;
 
-    if (shift > z)
-        bn_resize(src, src->size + 1);
+    if (shift > z && bn_resize(src, src->size + 1) < 0)
+        return -ENOMEM;
     /* bit shift */
     for (int i = src->size - 1; i > 0; i--)
         src->number[i] =
             src->number[i] << shift | src->number[i - 1] >> (32 - shift);
     src->number[0] <<= shift;
+    return 0;
 }
 
 /* right bit shift on bn (maximun shift 31) */
-void bn_rshift(bn *src, size_t shift)
+void bn2_rshift(bn *src, size_t shift)
 {
-    size_t z = 32 - bn_clz(src);
+    size_t z = 32 - bn2_clz(src);
     shift %= 32;  // only handle shift within 32 bits atm
     if (!shift)
         return;
@@ -123,72 +68,14 @@ void bn_rshift(bn *src, size_t shift)
         bn_resize(src, src->size - 1);
 }
 
-/*
- * compare length
- * return 1 if |a| > |b|
- * return -1 if |a| < |b|
- * return 0 if |a| = |b|
- */
-int bn_cmp(const bn *a, const bn *b)
-{
-    if (a->size > b->size) {
-        return 1;
-    } else if (a->size < b->size) {
-        return -1;
-    } else {
-        for (int i = a->size - 1; i >= 0; i--) {
-            if (a->number[i] > b->number[i])
-                return 1;
-            if (a->number[i] < b->number[i])
-                return -1;
-        }
-        return 0;
-    }
-}
-
-/*
- * output bn to decimal string
- * Note: the returned string should be freed with kfree()
- */
-char *bn_to_string(bn *src)
-{
-    // log10(x) = log2(x) / log2(10) ~= log2(x) / 3.322
-    size_t len = (8 * sizeof(int) * src->size) / 3 + 2 + src->sign;
-    char *s = kmalloc(len, GFP_KERNEL);
-    char *p = s;
-
-    memset(s, '0', len - 1);
-    s[len - 1] = '\0';
-
-    for (int i = src->size - 1; i >= 0; i--) {
-        for (unsigned int d = 1U << 31; d; d >>= 1) {
-            /* binary -> decimal string */
-            int carry = !!(d & src->number[i]);
-            for (int j = len - 2; j >= 0; j--) {
-                s[j] += s[j] - '0' + carry;  // double it
-                carry = (s[j] > '9');
-                if (carry)
-                    s[j] -= 10;
-            }
-        }
-    }
-    // skip leading zero
-    while (p[0] == '0' && p[1] != '\0') {
-        p++;
-    }
-    if (src->sign)
-        *(--p) = '-';
-    memmove(s, p, strlen(p) + 1);
-    return s;
-}
-
 /* |c| = |a| + |b| */
-static void bn_do_add(const bn *a, const bn *b, bn *c)
+static int bn2_do_add(const bn *a, const bn *b, bn *c)
 {
     // max digits = max(sizeof(a) + sizeof(b)) + 1
-    int d = MAX(bn_msb(a), bn_msb(b)) + 1;
+    int d = MAX(bn2_msb(a), bn2_msb(b)) + 1;
     d = DIV_ROUNDUP(d, 32) + !d;
-    bn_resize(c, d);  // round up, min size = 1
+    if (bn_resize(c, d) < 0)  // round up, min size = 1
+        return -ENOMEM;
 
     unsigned long long int carry = 0;
     for (int i = 0; i < c->size; i++) {
@@ -201,17 +88,19 @@ static void bn_do_add(const bn *a, const bn *b, bn *c)
 
     if (!c->number[c->size - 1] && c->size > 1)
         bn_resize(c, c->size - 1);
+    return 0;
 }
 
 /*
  * |c| = |a| - |b|
  * Note: |a| > |b| must be true
  */
-static void bn_do_sub(const bn *a, const bn *b, bn *c)
+static int bn2_do_sub(const bn *a, const bn *b, bn *c)
 {
     // max digits = max(sizeof(a) + sizeof(b))
     int d = MAX(a->size, b->size);
-    bn_resize(c, d);
+    if (bn_resize(c, d) < 0)
+        return -ENOMEM;
 
     long long int carry = 0;
     for (int i = 0; i < c->size; i++) {
@@ -228,62 +117,61 @@ static void bn_do_sub(const bn *a, const bn *b, bn *c)
         }
     }
 
-    d = bn_clz(c) / 32;
+    d = bn2_clz(c) / 32;
     if (d == c->size)
         --d;
     bn_resize(c, c->size - d);
+    return 0;
 }
 
 /* c = a + b
  * Note: work for c == a or c == b
  */
-void bn_add(const bn *a, const bn *b, bn *c)
+int bn2_add(const bn *a, const bn *b, bn *c)
 {
+    int sign, rc;
+
     if (a->sign == b->sign) {  // both positive or negative
-        bn_do_add(a, b, c);
-        c->sign = a->sign;
+        sign = a->sign;
+        rc = bn2_do_add(a, b, c);
     } else {          // different sign
         if (a->sign)  // let a > 0, b < 0
             SWAP(a, b);
         int cmp = bn_cmp(a, b);
         if (cmp > 0) {
             /* |a| > |b| and b < 0, hence c = a - |b| */
-            bn_do_sub(a, b, c);
-            c->sign = 0;
+            sign = 0;
+            rc = bn2_do_sub(a, b, c);
         } else if (cmp < 0) {
             /* |a| < |b| and b < 0, hence c = -(|b| - |a|) */
-            bn_do_sub(b, a, c);
-            c->sign = 1;
+            sign = 1;
+            rc = bn2_do_sub(b, a, c);
         } else {
             /* |a| == |b| */
             bn_resize(c, 1);
             c->number[0] = 0;
-            c->sign = 0;
+            sign = 0;
+            rc = 0;
         }
     }
+    c->sign = sign;
+    return rc;
 }
 
 /* c = a - b
  * Note: work for c == a or c == b
  */
-void bn_sub(const bn *a, const bn *b, bn *c)
+int bn2_sub(const bn *a, const bn *b, bn *c)
 {
-    /* xor the sign bit of b and let bn_add handle it */
+    /* xor the sign bit of b and let bn2_add handle it */
     bn tmp = *b;
     tmp.sign ^= 1;  // a - b = a + (-b)
-    bn_add(a, &tmp, c);
-}
-
-void bn_swap(bn *a, bn *b)
-{
-    bn tmp = *a;
-    *a = *b;
-    *b = tmp;
+    return bn2_add(a, &tmp, c);
 }
 
 /* c += x, starting from offset */
 
-static void bn_mult_add(bn *c, int offset, unsigned long long int x)
+static void bn2_mult_add(bn *c, int offset, unsigned long long int x)
 {
     unsigned long long int carry = 0;
     for (int i = offset; i < c->size; i++) {
@@ -298,35 +186,323 @@ static void bn_mult_add(bn *c, int offset, unsigned long long int x)
 
 /*
  * c = a x b
- * Note: work for c == a or c == b
+ * Note: c must not be a or b, so no temporary is needed
  * using the simple quadratic-time algorithm (long multiplication)
  */
-void bn_mult(const bn *a, const bn *b, bn *c)
+int bn2_mult(const bn *a, const bn *b, bn *c)
 {
     // max digits = sizeof(a) + sizeof(b))
-    int d = bn_msb(a) + bn_msb(b);
+    int d = bn2_msb(a) + bn2_msb(b);
     d = DIV_ROUNDUP(d, 32) + !d;  // round up, min size = 1
-    bn *tmp;
-    /* make it work properly when c == a or c == b */
-    if (c == a || c == b) {
-        tmp = c;  // save c
-        c = bn_alloc(d);
-    } else {
-        tmp = NULL;
-        bn_resize(c, d);
-    }
+    int sign = a->sign ^ b->sign;
 
+    if (c == a || c == b)
+        return -EINVAL;
+    if (bn_zero(c, d) < 0)
+        return -ENOMEM;
+
+    int rc = 0;
     for (int i = 0; i < a->size; i++) {
+        rc = bn_yield();
+        if (rc < 0)
+            break;
         for (int j = 0; j < b->size; j++) {
             unsigned long long int carry = 0;
             carry = (unsigned long long int) a->number[i] * b->number[j];
-            bn_mult_add(c, i + j, carry);
+            bn2_mult_add(c, i + j, carry);
+        }
+    }
+    c->sign = sign;
+
+    /* the product may have one bit less than msb(a) + msb(b) */
+    if (!c->number[c->size - 1] && c->size > 1)
+        bn_resize(c, c->size - 1);
+    return rc;
+}
+
+/* limbs of src without the leading zero limbs, at least 1 */
+static unsigned int bn2_len(const bn *src)
+{
+    unsigned int n = src->size;
+
+    while (n > 1 && !src->number[n - 1])
+        n--;
+    return n;
+}
+
+/* drop the leading zero limbs of src */
+static void bn2_trim(bn *src)
+{
+    bn_resize(src, bn2_len(src));
+}
+
+/* compare |a| and |b| like bn_cmp(), ignoring leading zero limbs */
+static int bn2_cmp(const bn *a, const bn *b)
+{
+    unsigned int la = bn2_len(a), lb = bn2_len(b);
+
+    if (la != lb)
+        return la > lb ? 1 : -1;
+    for (int i = la - 1; i >= 0; i--) {
+        if (a->number[i] != b->number[i])
+            return a->number[i] > b->number[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+/*
+ * q = |u| / |v|, r = |u| % |v| by Knuth's algorithm D (TAOCP 4.3.1)
+ * Note: v must have at least 2 limbs, q and r must not be u or v
+ * return 0 on success, -ENOMEM or -EINTR on error
+ */
+static int bn2_divmod(const bn *u, const bn *v, bn *q, bn *r)
+{
+    unsigned int n = bn2_len(v), m, s;
+    unsigned int *un, *vn;
+    bn *tu, *tv;
+    int rc = -ENOMEM;
+
+    if (bn2_cmp(u, v) < 0) {
+        rc = bn_zero(q, 1) ?: bn_cpy(r, (bn *) u);
+        bn2_trim(r);
+        return rc;
+    }
+    m = bn2_len(u) - n;
+
+    /* normalize: shift both so that the top limb of v has its top bit set */
+    s = __builtin_clz(v->number[n - 1]);
+    tu = bn_alloc(m + n + 1);
+    tv = bn_alloc(n);
+    if (!tu || !tv || bn_zero(q, m + 1) < 0)
+        goto out;
+    un = tu->number;
+    vn = tv->number;
+    for (int i = n - 1; i > 0; i--)
+        vn[i] = v->number[i] << s | (u64) v->number[i - 1] >> (32 - s);
+    vn[0] = v->number[0] << s;
+    un[m + n] = (u64) u->number[m + n - 1] >> (32 - s);
+    for (int i = m + n - 1; i > 0; i--)
+        un[i] = u->number[i] << s | (u64) u->number[i - 1] >> (32 - s);
+    un[0] = u->number[0] << s;
+
+    for (int j = m; j >= 0; j--) {
+        u64 num = (u64) un[j + n] << 32 | un[j + n - 1];
+        u32 rem;
+        u64 qhat = div_u64_rem(num, vn[n - 1], &rem);
+        u64 rhat = rem;
+        s64 t, k = 0;
+
+        /* each quotient limb costs O(n), as a row of bn2_mult() does */
+        rc = bn_yield();
+        if (rc < 0)
+            goto out;
+
+        /* qhat is now at most 2 too large, fix it with the next limb */
+        while (qhat >> 32 ||
+               qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >> 32)
+                break;
+        }
+
+        /* un[j .. j + n] -= qhat * vn */
+        for (unsigned int i = 0; i < n; i++) {
+            u64 p = qhat * vn[i];
+            t = un[i + j] - k - (p & 0xFFFFFFFF);
+            un[i + j] = t;
+            k = (p >> 32) - (t >> 32);
+        }
+        t = un[j + n] - k;
+        un[j + n] = t;
+
+        q->number[j] = qhat;
+        if (t < 0) {
+            /* qhat was still 1 too large, add vn back */
+            q->number[j]--;
+            k = 0;
+            for (unsigned int i = 0; i < n; i++) {
+                t = (u64) un[i + j] + vn[i] + k;
+                un[i + j] = t;
+                k = t >> 32;
+            }
+            un[j + n] += k;
         }
     }
-    c->sign = a->sign ^ b->sign;
 
-    if (tmp) {
-        bn_cpy(tmp, c);  // restore c
-        bn_free(c);
+    /* r = un >> s */
+    rc = -ENOMEM;
+    if (bn_zero(r, n) < 0)
+        goto out;
+    for (unsigned int i = 0; i < n - 1; i++)
+        r->number[i] = un[i] >> s | (u64) un[i + 1] << (32 - s);
+    r->number[n - 1] = un[n - 1] >> s;
+    bn2_trim(q);
+    bn2_trim(r);
+    rc = 0;
+out:
+    bn_free(tu);
+    bn_free(tv);
+    return rc;
+}
+
+/* numbers below 10^(9 * 2^BN2_EMIT_BASE) are converted by short division */
+#define BN2_EMIT_BASE 4
+#define BN2_EMIT_BLOCK (9 << BN2_EMIT_BASE)
+#define BN2_EMIT_LIMBS 16 /* 10^144 < 2^(32 * 16) */
+/* 10^(9 * 2^k) for k < BN2_EMIT_POWS covers any 2^32-limb number */
+#define BN2_EMIT_POWS 40
+
+/* x < 10^(9 * 2^BN2_EMIT_BASE) to sink, zero padded to the full block if pad */
+static int bn2_emit_block(const bn *x, bool pad, bn_sink_t sink, void *arg)
+{
+    char block[BN2_EMIT_BLOCK];
+    u32 w[BN2_EMIT_LIMBS] = {0};
+    unsigned int len = bn2_len(x), top = len;
+    char *p = block + sizeof(block);
+
+    memcpy(w, x->number, sizeof(u32) * len);
+    do {
+        /* w /= 10^9, then its 9 digits from the remainder */
+        u32 rem = 0;
+        for (int i = top - 1; i >= 0; i--)
+            w[i] = div_u64_rem((u64) rem << 32 | w[i], 1000000000U, &rem);
+        while (top > 1 && !w[top - 1])
+            top--;
+        for (int d = 0; d < 9; d++) {
+            *--p = '0' + rem % 10;
+            rem /= 10;
+        }
+    } while (top > 1 || w[0]);
+
+    if (pad) {
+        memset(block, '0', p - block);
+        p = block;
+    } else {
+        while (p < block + sizeof(block) - 1 && *p == '0')
+            p++;
     }
+    return sink(arg, p, block + sizeof(block) - p);
 }
+
+/*
+ * |x| < pow[k] to sink, zero padded to 9 * 2^k digits if pad: split into
+ * the high and low halves by pow[k - 1], emit the high one first
+ */
+static int bn2_emit_rec(const bn *x,
+                        bn *const *pow,
+                        int k,
+                        bool pad,
+                        bn_sink_t sink,
+                        void *arg)
+{
+    bn *q, *r;
+    int rc;
+
+    if (k <= BN2_EMIT_BASE)
+        return bn2_emit_block(x, pad, sink, arg);
+    if (!pad && bn2_cmp(x, pow[k - 1]) < 0)
+        return bn2_emit_rec(x, pow, k - 1, false, sink, arg);
+
+    rc = bn_yield();
+    if (rc < 0)
+        return rc;
+    q = bn_alloc(1);
+    r = bn_alloc(1);
+    if (!q || !r)
+        rc = -ENOMEM;
+    else
+        rc = bn2_divmod(x, pow[k - 1], q, r);
+    /* the quotient is not needed once emitted, nor the remainder's parent */
+    rc = rc ?: bn2_emit_rec(q, pow, k - 1, pad, sink, arg);
+    bn_free(q);
+    rc = rc ?: bn2_emit_rec(r, pow, k - 1, true, sink, arg);
+    bn_free(r);
+    return rc;
+}
+
+/*
+ * output bn to sink in decimal, most significant block first
+ * divide and conquer over pow[k] = 10^(9 * 2^k), so a block goes out as soon
+ * as it is converted and no string of the whole number is ever built
+ * return 0 on success (also when sink stopped early), or the error of sink,
+ * -ENOMEM or -EINTR
+ */
+int bn2_emit(const bn *src, bn_sink_t sink, void *arg)
+{
+    bn *pow[BN2_EMIT_POWS] = {NULL};
+    int k = 0, rc = 0;
+
+    if (src->sign && (bn2_len(src) > 1 || src->number[0]))
+        rc = sink(arg, "-", 1);
+
+    /* pow[k] up to the first one above src */
+    pow[0] = bn_alloc(1);
+    if (pow[0])
+        pow[0]->number[0] = 1000000000U;
+    else
+        rc = rc ?: -ENOMEM;
+    while (!rc && bn2_cmp(src, pow[k]) >= 0) {
+        pow[k + 1] = bn_alloc(1);
+        if (!pow[k + 1]) {
+            rc = -ENOMEM;
+            break;
+        }
+        rc = bn2_mult(pow[k], pow[k], pow[k + 1]);
+        bn2_trim(pow[++k]);
+    }
+
+    rc = rc ?: bn2_emit_rec(src, pow, k, false, sink, arg);
+    for (int i = 0; i < BN2_EMIT_POWS; i++)
+        bn_free(pow[i]);
+    return rc < 0 ? rc : 0;
+}
+
+struct bn2_string {
+    char *s;
+    size_t len;
+};
+
+static int bn2_string_sink(void *arg, const char *s, size_t len)
+{
+    struct bn2_string *str = arg;
+
+    memcpy(str->s + str->len, s, len);
+    str->len += len;
+    return 0;
+}
+
+/*
+ * output bn to decimal string
+ * Note: the returned string comes from bn_pool_get(), it should be given back
+ * with bn_pool_put() and the size stored in *size
+ * return ERR_PTR(-ENOMEM) or ERR_PTR(-EINTR) on error
+ */
+char *bn2_to_string(bn *src, size_t *size)
+{
+    // log10(x) = log2(x) / log2(10) ~= log2(x) / 3.322
+    size_t len = (8 * sizeof(int) * src->size) / 3 + 2 + src->sign;
+    struct bn2_string str = {bn_pool_get(len, size), 0};
+    int rc;
+
+    if (!str.s)
+        return ERR_PTR(-ENOMEM);
+    rc = bn2_emit(src, bn2_string_sink, &str);
+    if (rc < 0) {
+        bn_pool_put(str.s, *size);
+        return ERR_PTR(rc);
+    }
+    str.s[str.len] = '\0';
+    return str.s;
+}
+
+const struct bn_ops bn2_ops = {
+    .name = "bn2",
+    .add = bn2_add,
+    .sub = bn2_sub,
+    .mult = bn2_mult,
+    .to_string = bn2_to_string,
+    .emit = bn2_emit,
+};
+
+#endif /* BN2_H */
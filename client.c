@@ -1,23 +1,255 @@
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "fibdrv.h"
+
 #define FIB_DEV "/dev/fibonacci"
+#define FIB_SEQ_DEV "/dev/fibonacci_seq"
+
+/* exact bytes read() returns for F(n), the digits and the NUL */
+size_t cal_buf_size(int fd, int n)
+{
+    struct fib_info info = {.n = n};
+
+    if (ioctl(fd, FIB_IOC_INFO, &info) < 0) {
+        perror("Failed to query the size");
+        exit(1);
+    }
+    return info.dec_bytes;
+}
+
+/*
+ * "./client full": the checks below print one result per line, and
+ * scripts/verify.py compares each with the exact value
+ */
 
-#define LOGPHI (20898764025)
-#define LOGSQRT5 (34948500216)
-#define SCALE (100000000000)
+/* indices covering the table, the backend crossovers and larger n */
+static const unsigned int full_ns[] = {
+    0,   1,   2,   50,  51,  93,  94,  185, 186,  187,  188,
+    250, 299, 300, 301, 302, 400, 512, 1000, 4096, 10000,
+};
+#define FULL_NS (sizeof(full_ns) / sizeof(full_ns[0]))
 
-size_t cal_buf_size(int n)
+static void full_fail(const char *what)
 {
-    size_t digits = (n * LOGPHI - LOGSQRT5) / SCALE;
-    return digits + 2;
+    perror(what);
+    exit(1);
 }
 
-int main()
+static void full_set_mode(int fd, __u32 backend, __u32 algo, __u32 format)
+{
+    struct fib_mode mode = {backend, algo, format};
+
+    if (ioctl(fd, FIB_IOC_SET_MODE, &mode) < 0)
+        full_fail("Failed to set the mode");
+}
+
+/* "mode <backend> <algo> <n> <F(n)>" under every backend and algorithm */
+static void full_modes(int fd)
+{
+    for (__u32 backend = 0; backend <= FIB_BACKEND_BN10; backend++) {
+        for (__u32 algo = 0; algo <= FIB_ALGO_FDOUBLING; algo++) {
+            full_set_mode(fd, backend, algo, FIB_FMT_DEC);
+            for (size_t i = 0; i < FULL_NS; i++) {
+                size_t size = cal_buf_size(fd, full_ns[i]);
+                char *buf = malloc(size);
+
+                lseek(fd, full_ns[i], SEEK_SET);
+                if (read(fd, buf, size) < 0)
+                    full_fail("Failed to read");
+                printf("mode %u %u %u %.*s\n", backend, algo, full_ns[i],
+                       (int) size, buf);
+                free(buf);
+            }
+        }
+    }
+    full_set_mode(fd, FIB_BACKEND_AUTO, FIB_ALGO_AUTO, FIB_FMT_DEC);
+}
+
+/*
+ * "info <n> <bits> <digits> <bn2_limbs> <bn10_limbs> <dec_bytes> <bin_bytes>
+ * <dec_len> <bin_hex> <spill>": what FIB_IOC_INFO says against what read()
+ * returns in a buffer larger than that, dec_len counting the NUL, and spill
+ * the bytes written past bin_bytes in FIB_FMT_BIN
+ */
+static void full_info(int fd)
+{
+    for (size_t i = 0; i < FULL_NS; i++) {
+        struct fib_info info = {.n = full_ns[i]};
+        size_t size, spill = 0;
+        unsigned char *buf;
+
+        if (ioctl(fd, FIB_IOC_INFO, &info) < 0)
+            full_fail("Failed to query the size");
+        size = info.dec_bytes + info.bin_bytes + 64;
+        buf = malloc(size);
+
+        memset(buf, 0xff, size);
+        lseek(fd, info.n, SEEK_SET);
+        if (read(fd, buf, size) < 0)
+            full_fail("Failed to read");
+        printf("info %llu %llu %llu %llu %llu %llu %llu %zu ", info.n,
+               info.bits, info.digits, info.bn2_limbs, info.bn10_limbs,
+               info.dec_bytes, info.bin_bytes, strlen((char *) buf) + 1);
+
+        full_set_mode(fd, FIB_BACKEND_AUTO, FIB_ALGO_AUTO, FIB_FMT_BIN);
+        memset(buf, 0xff, size);
+        lseek(fd, info.n, SEEK_SET);
+        if (read(fd, buf, info.bin_bytes + 64) < 0)
+            full_fail("Failed to read");
+        for (size_t j = info.bin_bytes; j > 0; j -= 4) {
+            __u32 word;
+            memcpy(&word, buf + j - 4, 4);
+            printf("%08x", word);
+        }
+        for (size_t j = info.bin_bytes; j < info.bin_bytes + 64; j++)
+            spill += buf[j] != 0xff;
+        printf(" %zu\n", spill);
+        full_set_mode(fd, FIB_BACKEND_AUTO, FIB_ALGO_AUTO, FIB_FMT_DEC);
+        free(buf);
+    }
+}
+
+/* "lead <n> <k> <digits>" and "trail <n> <k> <digits>" */
+static void full_digits(int fd)
+{
+    static const __u64 ns[] = {0, 1, 93, 94, 1000, 100000};
+    static const __u32 ks[] = {1, 10, 18};
+
+    for (size_t i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+        for (size_t j = 0; j < sizeof(ks) / sizeof(ks[0]); j++) {
+            struct fib_digits q = {.n = ns[i], .k = ks[j]};
+
+            if (ioctl(fd, FIB_IOC_LEADING, &q) < 0)
+                full_fail("Failed to query leading digits");
+            printf("lead %llu %u %0*llu\n", q.n, q.k, q.len, q.value);
+            if (ioctl(fd, FIB_IOC_TRAILING, &q) < 0)
+                full_fail("Failed to query trailing digits");
+            printf("trail %llu %u %0*llu\n", q.n, q.k, q.len, q.value);
+        }
+    }
+}
+
+/* "batch <n> <F(n)>", the indices unsorted and one repeated */
+static void full_batch(int fd)
+{
+    __u32 ns[] = {5000, 0, 187, 186, 1000, 301, 300, 5000, 2, 12345};
+    __u64 offsets[sizeof(ns) / sizeof(ns[0])];
+    struct fib_batch batch = {
+        .ns = (uintptr_t) ns,
+        .offsets = (uintptr_t) offsets,
+        .count = sizeof(ns) / sizeof(ns[0]),
+    };
+    char *buf;
+
+    /* an empty buffer fails with the size needed */
+    if (ioctl(fd, FIB_IOC_BATCH, &batch) == 0)
+        full_fail("Batch into an empty buffer");
+    buf = malloc(batch.buf_len);
+    batch.buf = (uintptr_t) buf;
+    if (ioctl(fd, FIB_IOC_BATCH, &batch) < 0)
+        full_fail("Failed to batch");
+    for (__u32 i = 0; i < batch.count; i++)
+        printf("batch %u %s\n", ns[i], buf + offsets[i]);
+    free(buf);
+}
+
+/* "seq <k> <F(k)>" for the whole lines of 64 KiB read from F(90) on */
+static void full_seq(void)
+{
+    size_t size = 64 * 1024, k = 90;
+    char *buf = malloc(size + 1), *line, *end;
+    ssize_t len;
+    int fd = open(FIB_SEQ_DEV, O_RDONLY);
+
+    if (fd < 0)
+        full_fail("Failed to open " FIB_SEQ_DEV);
+    lseek(fd, k, SEEK_SET);
+    len = read(fd, buf, size);
+    if (len < 0)
+        full_fail("Failed to read " FIB_SEQ_DEV);
+    buf[len] = '\0';
+    for (line = buf; (end = strchr(line, '\n')); line = end + 1, k++) {
+        *end = '\0';
+        printf("seq %zu %s\n", k, line);
+    }
+    free(buf);
+    close(fd);
+}
+
+/*
+ * "fibfs <n> <size> <F(n)>" and "fibfs_bin <n> <size> <hex>" from the files
+ * of a fibfs mounted on a temporary directory
+ */
+static void full_fibfs(void)
+{
+    static const unsigned int ns[] = {0, 1, 186, 187, 1000, 5000};
+    char dir[] = "/tmp/fibfs.XXXXXX";
+
+    if (!mkdtemp(dir))
+        full_fail("Failed to create a mount point");
+    if (mount("none", dir, "fibfs", 0, NULL) < 0)
+        full_fail("Failed to mount fibfs");
+
+    for (size_t i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+        for (int bin = 0; bin < 2; bin++) {
+            char path[64];
+            struct stat st;
+            unsigned char *buf;
+            int fd;
+
+            snprintf(path, sizeof(path), "%s/%u%s", dir, ns[i],
+                     bin ? ".bin" : "");
+            fd = open(path, O_RDONLY);
+            if (fd < 0 || fstat(fd, &st) < 0)
+                full_fail("Failed to open a fibfs file");
+            buf = malloc(st.st_size);
+            if (read(fd, buf, st.st_size) != st.st_size)
+                full_fail("Failed to read a fibfs file");
+            if (bin) {
+                printf("fibfs_bin %u %lld ", ns[i], (long long) st.st_size);
+                for (off_t j = st.st_size; j > 0; j -= 4) {
+                    __u32 word;
+                    memcpy(&word, buf + j - 4, 4);
+                    printf("%08x", word);
+                }
+                printf("\n");
+            } else {
+                /* the newline ends the line */
+                printf("fibfs %u %lld %.*s", ns[i], (long long) st.st_size,
+                       (int) st.st_size, buf);
+            }
+            free(buf);
+            close(fd);
+        }
+    }
+
+    if (umount(dir) < 0)
+        full_fail("Failed to unmount fibfs");
+    rmdir(dir);
+}
+
+static int full_check(int fd)
+{
+    full_modes(fd);
+    full_info(fd);
+    full_digits(fd);
+    full_batch(fd);
+    full_seq();
+    full_fibfs();
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
     long long sz;
 
@@ -31,13 +263,16 @@ int main()
         exit(1);
     }
 
+    if (argc > 1 && !strcmp(argv[1], "full"))
+        return full_check(fd);
+
     for (int i = 0; i <= offset; i++) {
         sz = write(fd, write_buf, strlen(write_buf));
         printf("Writing to " FIB_DEV ", returned the sequence %lld\n", sz);
     }
 
     for (int i = 0; i <= offset; i++) {
-        size_t size = cal_buf_size(i);
+        size_t size = cal_buf_size(fd, i);
         buf = malloc(size);
         lseek(fd, i, SEEK_SET);
         sz = read(fd, buf, size);
@@ -49,7 +284,7 @@ int main()
     }
 
     for (int i = offset; i >= 0; i--) {
-        size_t size = cal_buf_size(i);
+        size_t size = cal_buf_size(fd, i);
         buf = malloc(size);
         lseek(fd, i, SEEK_SET);
         sz = read(fd, buf, size);
@@ -2,15 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#define FIB_DEV "/dev/fibonacci"
+#include "fibdrv.h"
 
-#define LOGPHI (20898764025)
-#define LOGSQRT5 (34948500216)
-#define SCALE (100000000000)
+#define FIB_DEV "/dev/fibonacci"
 
 #define OFFSET 100
 
@@ -21,10 +20,16 @@ static inline long long get_nanotime()
     return ts.tv_sec * 1e9 + ts.tv_nsec;
 }
 
-size_t cal_buf_size(int n)
+/* exact bytes read() returns for F(n), the digits and the NUL */
+size_t cal_buf_size(int fd, int n)
 {
-    size_t digits = (n * LOGPHI - LOGSQRT5) / SCALE;
-    return digits + 2;
+    struct fib_info info = {.n = n};
+
+    if (ioctl(fd, FIB_IOC_INFO, &info) < 0) {
+        perror("Failed to query the size");
+        exit(1);
+    }
+    return info.dec_bytes;
 }
 
 int main(int argc, char const *argv[])
@@ -42,9 +47,10 @@ int main(int argc, char const *argv[])
     }
 
     for (int i = 0; i <= OFFSET; i++) {
+        /* the size query is a syscall of its own, keep it out of utime */
+        size_t size = cal_buf_size(fd, i);
         lseek(fd, i, SEEK_SET);
         long long start = get_nanotime();
-        size_t size = cal_buf_size(i);
         char *buf = malloc(size);
         long long ktime = read(fd, buf, size);
         long long utime = get_nanotime() - start;
@@ -0,0 +1,399 @@
+#ifndef FIBDIGITS_H
+#define FIBDIGITS_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+
+#include "fibdrv.h"
+
+/*
+ * Leading and trailing decimal digits of F(n) without the bignum engine.
+ *
+ * leading:  log10(F(n)) = n * log10(phi) - log10(sqrt(5)) + O(phi^-2n), the
+ *           digits come from 10 ^ frac(log10(F(n))) in fixed point
+ * trailing: fast doubling modulo 10^k
+ *
+ * Both run in O(log n) for any 64-bit n.
+ */
+
+/* F(93) is the largest Fibonacci number that fits in u64 */
+#define FIB_U64_MAX_N 93
+
+/* fractions of log10(phi) and log10(sqrt(5)), Q0.192, most significant first */
+static const u64 log10_phi[3] = {
+    0x358036c82451b7f3ULL,
+    0x65d3db23845599f5ULL,
+    0x887a5e47e9bdd71cULL,
+};
+static const u64 log10_sqrt5[3] = {
+    0x5977d95ec10c0219ULL,
+    0xdc1da994fd20dba1ULL,
+    0xf654b3ceaf0b832dULL,
+};
+
+/* the same for log2(phi) and log2(sqrt(5)) - 1 */
+static const u64 log2_phi[3] = {
+    0xb1b9d68a8e53425dULL,
+    0xe48fc7426f0c4428ULL,
+    0x20d63c23e0c56cb0ULL,
+};
+static const u64 log2_sqrt5[3] = {
+    0x2934f0979a3715fcULL,
+    0x9257edfe9b5fb699ULL,
+    0xb2d8abfc6f675a9dULL,
+};
+
+/*
+ * pow10_frac[i] = 10 ^ (2 ^ -(i + 1)) in Q4.124, stored as {high, low};
+ * bits of the fraction below 2^-124 change the result by less than 1 ulp
+ */
+static const u64 pow10_frac[124][2] = {
+    {0x3298b075b4b6a524ULL, 0x0945790619b37fd5ULL},
+    {0x1c73d51c54470e30ULL, 0xfe6f9311d01e8369ULL},
+    {0x15561a91ba81443dULL, 0xdc7327cc4b3307c8ULL},
+    {0x1279fcaca404e5acULL, 0xcb5499f25b6d94e8ULL},
+    {0x113197fa6aa6776bULL, 0x27893c62914607a3ULL},
+    {0x10960c68d98bc2bfULL, 0x2e022919eabc4226ULL},
+    {0x104a5975b254b8aeULL, 0x4077c2f56458fcfcULL},
+    {0x102501ee61ca6267ULL, 0x1e4fa4f8abdf212dULL},
+    {0x101276506106747aULL, 0xa3b1aab6aeb4b50eULL},
+    {0x1009388004be7e55ULL, 0x92e3f8d6c82736b3ULL},
+    {0x10049b96285bc0a7ULL, 0x363c07b134055792ULL},
+    {0x10024da0a3c92c8cULL, 0xc11499f5931deaf2ULL},
+    {0x100126c5b68ed631ULL, 0xf08c1fff9b1f311dULL},
+    {0x10009360348a6725ULL, 0xcfeba1059a0b4ce0ULL},
+    {0x100049af7098ffffULL, 0xc25510fadf1d9042ULL},
+    {0x100024d78de1d4c6ULL, 0xc2bbc6a8ef5d916dULL},
+    {0x1000126bbc564bcaULL, 0x768860bf564eeda3ULL},
+    {0x10000935db847fc5ULL, 0xaa9e081feeda3071ULL},
+    {0x1000049aed18968bULL, 0xc64ec84c8fb8e09eULL},
+    {0x1000024d7661e0f6ULL, 0x3a0af573a6217720ULL},
+    {0x10000126bb2655e7ULL, 0xf612ba7c416be3a3ULL},
+    {0x100000935d90844fULL, 0x49b73713144cacdcULL},
+    {0x10000049aec7987eULL, 0x7b946322b95fc265ULL},
+    {0x10000024d763a1d4ULL, 0xf3da0d9a9d3dfa66ULL},
+    {0x100000126bb1c64fULL, 0xe77d3313e4c1d005ULL},
+    {0x1000000935d8e081ULL, 0x4f242b441f1ffb96ULL},
+    {0x100000049aec6f96ULL, 0xfe6baae5ab8df5e1ULL},
+    {0x100000024d7637a1ULL, 0x14ec40de5edeb5d1ULL},
+    {0x1000000126bb1bc5ULL, 0xefe3bc0d65f838a4ULL},
+    {0x10000000935d8de0ULL, 0x514d4506ab26b017ULL},
+    {0x1000000049aec6efULL, 0x7efd7c4660ef086fULL},
+    {0x1000000024d76377ULL, 0x9514749454f891bdULL},
+    {0x10000000126bb1bbULL, 0xbfefa7e67fd1d06eULL},
+    {0x100000000935d8ddULL, 0xdd512f5a56c4f2a0ULL},
+    {0x10000000049aec6eULL, 0xedfeee86f14a50fbULL},
+    {0x10000000024d7637ULL, 0x76d50cf9ea25390aULL},
+    {0x100000000126bb1bULL, 0xbb5febea917363fdULL},
+    {0x1000000000935d8dULL, 0xddad4f50afd1fc47ULL},
+    {0x100000000049aec6ULL, 0xeed5fdff31af13c3ULL},
+    {0x100000000024d763ULL, 0x776ad4954f490fabULL},
+    {0x1000000000126bb1ULL, 0xbbb55fb01540e954ULL},
+    {0x10000000000935d8ULL, 0xdddaad3166078d0bULL},
+    {0x1000000000049aecULL, 0x6eed55ef09dd8c9eULL},
+    {0x1000000000024d76ULL, 0x3776aacd1aa537d5ULL},
+    {0x10000000000126bbULL, 0x1bbb555bf2c0384cULL},
+    {0x100000000000935dULL, 0x8dddaaab52bb833eULL},
+    {0x10000000000049aeULL, 0xc6eed554ffb49b65ULL},
+    {0x10000000000024d7ULL, 0x63776aaa55700424ULL},
+    {0x100000000000126bULL, 0xb1bbb555201d6faeULL},
+    {0x1000000000000935ULL, 0xd8dddaaa8d68133eULL},
+    {0x100000000000049aULL, 0xec6eed55460a6079ULL},
+    {0x100000000000024dULL, 0x763776aaa2dac5f3ULL},
+    {0x1000000000000126ULL, 0xbb1bbb555162c867ULL},
+    {0x1000000000000093ULL, 0x5d8dddaaa8aebd8fULL},
+    {0x1000000000000049ULL, 0xaec6eed55456b51eULL},
+    {0x1000000000000024ULL, 0xd763776aaa2b3025ULL},
+    {0x1000000000000012ULL, 0x6bb1bbb555158d78ULL},
+    {0x1000000000000009ULL, 0x35d8dddaaa8ac415ULL},
+    {0x1000000000000004ULL, 0x9aec6eed55456161ULL},
+    {0x1000000000000002ULL, 0x4d763776aaa2b086ULL},
+    {0x1000000000000001ULL, 0x26bb1bbb55515838ULL},
+    {0x1000000000000000ULL, 0x935d8dddaaa8ac1aULL},
+    {0x1000000000000000ULL, 0x49aec6eed554560cULL},
+    {0x1000000000000000ULL, 0x24d763776aaa2b06ULL},
+    {0x1000000000000000ULL, 0x126bb1bbb5551583ULL},
+    {0x1000000000000000ULL, 0x0935d8dddaaa8ac1ULL},
+    {0x1000000000000000ULL, 0x049aec6eed554561ULL},
+    {0x1000000000000000ULL, 0x024d763776aaa2b0ULL},
+    {0x1000000000000000ULL, 0x0126bb1bbb555158ULL},
+    {0x1000000000000000ULL, 0x00935d8dddaaa8acULL},
+    {0x1000000000000000ULL, 0x0049aec6eed55456ULL},
+    {0x1000000000000000ULL, 0x0024d763776aaa2bULL},
+    {0x1000000000000000ULL, 0x00126bb1bbb55516ULL},
+    {0x1000000000000000ULL, 0x000935d8dddaaa8bULL},
+    {0x1000000000000000ULL, 0x00049aec6eed5545ULL},
+    {0x1000000000000000ULL, 0x00024d763776aaa3ULL},
+    {0x1000000000000000ULL, 0x000126bb1bbb5551ULL},
+    {0x1000000000000000ULL, 0x0000935d8dddaaa9ULL},
+    {0x1000000000000000ULL, 0x000049aec6eed554ULL},
+    {0x1000000000000000ULL, 0x000024d763776aaaULL},
+    {0x1000000000000000ULL, 0x0000126bb1bbb555ULL},
+    {0x1000000000000000ULL, 0x00000935d8dddaabULL},
+    {0x1000000000000000ULL, 0x0000049aec6eed55ULL},
+    {0x1000000000000000ULL, 0x0000024d763776abULL},
+    {0x1000000000000000ULL, 0x00000126bb1bbb55ULL},
+    {0x1000000000000000ULL, 0x000000935d8dddabULL},
+    {0x1000000000000000ULL, 0x00000049aec6eed5ULL},
+    {0x1000000000000000ULL, 0x00000024d763776bULL},
+    {0x1000000000000000ULL, 0x000000126bb1bbb5ULL},
+    {0x1000000000000000ULL, 0x0000000935d8dddbULL},
+    {0x1000000000000000ULL, 0x000000049aec6eedULL},
+    {0x1000000000000000ULL, 0x000000024d763777ULL},
+    {0x1000000000000000ULL, 0x0000000126bb1bbbULL},
+    {0x1000000000000000ULL, 0x00000000935d8ddeULL},
+    {0x1000000000000000ULL, 0x0000000049aec6efULL},
+    {0x1000000000000000ULL, 0x0000000024d76377ULL},
+    {0x1000000000000000ULL, 0x00000000126bb1bcULL},
+    {0x1000000000000000ULL, 0x000000000935d8deULL},
+    {0x1000000000000000ULL, 0x00000000049aec6fULL},
+    {0x1000000000000000ULL, 0x00000000024d7637ULL},
+    {0x1000000000000000ULL, 0x000000000126bb1cULL},
+    {0x1000000000000000ULL, 0x0000000000935d8eULL},
+    {0x1000000000000000ULL, 0x000000000049aec7ULL},
+    {0x1000000000000000ULL, 0x000000000024d763ULL},
+    {0x1000000000000000ULL, 0x0000000000126bb2ULL},
+    {0x1000000000000000ULL, 0x00000000000935d9ULL},
+    {0x1000000000000000ULL, 0x0000000000049aecULL},
+    {0x1000000000000000ULL, 0x0000000000024d76ULL},
+    {0x1000000000000000ULL, 0x00000000000126bbULL},
+    {0x1000000000000000ULL, 0x000000000000935eULL},
+    {0x1000000000000000ULL, 0x00000000000049afULL},
+    {0x1000000000000000ULL, 0x00000000000024d7ULL},
+    {0x1000000000000000ULL, 0x000000000000126cULL},
+    {0x1000000000000000ULL, 0x0000000000000936ULL},
+    {0x1000000000000000ULL, 0x000000000000049bULL},
+    {0x1000000000000000ULL, 0x000000000000024dULL},
+    {0x1000000000000000ULL, 0x0000000000000127ULL},
+    {0x1000000000000000ULL, 0x0000000000000093ULL},
+    {0x1000000000000000ULL, 0x000000000000004aULL},
+    {0x1000000000000000ULL, 0x0000000000000025ULL},
+    {0x1000000000000000ULL, 0x0000000000000012ULL},
+    {0x1000000000000000ULL, 0x0000000000000009ULL},
+    {0x1000000000000000ULL, 0x0000000000000005ULL},
+    {0x1000000000000000ULL, 0x0000000000000002ULL},
+};
+
+static const u64 pow10_u64[FIB_DIGITS_MAX + 2] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+/* F(n) for n <= FIB_U64_MAX_N */
+static u64 fib_u64(unsigned int n)
+{
+    u64 a = 0, b = 1;
+
+    for (unsigned int i = 0; i < n; i++) {
+        u64 t = a + b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* count the decimal digits of x, at least 1 */
+static unsigned int u64_digits(u64 x)
+{
+    unsigned int d = 1;
+
+    while (d < ARRAY_SIZE(pow10_u64) && x >= pow10_u64[d])
+        d++;
+    return d;
+}
+
+/* (a + b) mod m, for a, b < m < 2^63 */
+static u64 addmod(u64 a, u64 b, u64 m)
+{
+    a += b;
+    return a >= m ? a - m : a;
+}
+
+/* (a * b) mod m, for a, b < m < 2^63 */
+static u64 mulmod(u64 a, u64 b, u64 m)
+{
+    u64 r = 0;
+
+    for (; b; b >>= 1) {
+        if (b & 1)
+            r = addmod(r, a, m);
+        a = addmod(a, a, m);
+    }
+    return r;
+}
+
+/* (a * b) >> 124, both in Q4.124 */
+static __uint128_t fix_mul(__uint128_t a, __uint128_t b)
+{
+    u64 a0 = a, a1 = a >> 64;
+    u64 b0 = b, b1 = b >> 64;
+    __uint128_t p00 = (__uint128_t) a0 * b0;
+    __uint128_t p01 = (__uint128_t) a0 * b1;
+    __uint128_t p10 = (__uint128_t) a1 * b0;
+    __uint128_t p11 = (__uint128_t) a1 * b1;
+    __uint128_t mid = (p00 >> 64) + (u64) p01 + (u64) p10;
+    __uint128_t hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+
+    return hi << 4 | (u64) mid >> 60;
+}
+
+/*
+ * n * c - s for n > FIB_U64_MAX_N, c and s in Q0.192
+ * return the integer part, the top 128 bits of the fraction go to *frac
+ */
+static u64 fib_log(u64 n, const u64 *c, const u64 *s, __uint128_t *frac)
+{
+    __uint128_t t;
+    u64 f[3], ip, borrow = 0;
+
+    t = (__uint128_t) n * c[2];
+    f[2] = t;
+    t = (__uint128_t) n * c[1] + (u64) (t >> 64);
+    f[1] = t;
+    t = (__uint128_t) n * c[0] + (u64) (t >> 64);
+    f[0] = t;
+    ip = t >> 64;
+
+    for (int i = 2; i >= 0; i--) {
+        u64 d = f[i] - s[i] - borrow;
+        borrow = f[i] < s[i] || (f[i] == s[i] && borrow);
+        f[i] = d;
+    }
+    *frac = (__uint128_t) f[0] << 64 | f[1];
+    return ip - borrow;
+}
+
+/* n * log10(phi) - log10(sqrt(5)), see fib_log() */
+static u64 fib_log10(u64 n, __uint128_t *frac)
+{
+    return fib_log(n, log10_phi, log10_sqrt5, frac);
+}
+
+/* 10 ^ frac in Q4.124, frac in Q0.128 */
+static __uint128_t fib_pow10(__uint128_t frac)
+{
+    __uint128_t r = (__uint128_t) 1 << 124;
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(pow10_frac); i++) {
+        if (frac & ((__uint128_t) 1 << (127 - i)))
+            r = fix_mul(r, (__uint128_t) pow10_frac[i][0] << 64 |
+                               pow10_frac[i][1]);
+    }
+    return r;
+}
+
+/* number of decimal digits of F(n) */
+u64 fib_digits(u64 n)
+{
+    __uint128_t frac;
+
+    if (n <= FIB_U64_MAX_N)
+        return u64_digits(fib_u64(n));
+    return fib_log10(n, &frac) + 1;
+}
+
+/* number of bits of F(n), 0 for F(0) */
+u64 fib_bits(u64 n)
+{
+    __uint128_t frac;
+
+    if (n <= FIB_U64_MAX_N)
+        return n ? 64 - __builtin_clzll(fib_u64(n)) : 0;
+    /* log2(sqrt(5)) - 1 is in log2_sqrt5, so this is floor(log2(F(n))) + 1 */
+    return fib_log(n, log2_phi, log2_sqrt5, &frac);
+}
+
+/*
+ * first min(k, digits of F(n)) digits of F(n)
+ * return 0 on success, -EINVAL if k is out of range
+ */
+int fib_leading(u64 n, unsigned int k, u64 *value, unsigned int *len)
+{
+    __uint128_t frac, p;
+    u64 lo, hi;
+
+    if (!k || k > FIB_DIGITS_MAX)
+        return -EINVAL;
+
+    if (n <= FIB_U64_MAX_N) {
+        u64 x = fib_u64(n);
+        unsigned int d = u64_digits(x);
+
+        *len = min(k, d);
+        *value = div64_u64(x, pow10_u64[d - *len]);
+        return 0;
+    }
+
+    /* floor(10^frac * 10^(k-1)), 10^frac in Q4.124 */
+    fib_log10(n, &frac);
+    p = fib_pow10(frac);
+    lo = p;
+    hi = p >> 64;
+    p = (__uint128_t) hi * pow10_u64[k - 1] +
+        (u64) (((__uint128_t) lo * pow10_u64[k - 1]) >> 64);
+    *value = p >> 60;
+    *len = k;
+    return 0;
+}
+
+/*
+ * last min(k, digits of F(n)) digits of F(n)
+ * return 0 on success, -EINVAL if k is out of range
+ */
+int fib_trailing(u64 n, unsigned int k, u64 *value, unsigned int *len)
+{
+    u64 m, a = 0, b = 1; /* F(i), F(i+1) mod m */
+
+    if (!k || k > FIB_DIGITS_MAX)
+        return -EINVAL;
+
+    if (n <= FIB_U64_MAX_N) {
+        u64 x = fib_u64(n);
+        u64 rem;
+
+        *len = min(k, u64_digits(x));
+        div64_u64_rem(x, pow10_u64[*len], &rem);
+        *value = rem;
+        return 0;
+    }
+
+    m = pow10_u64[k];
+    for (u64 i = 1ULL << (63 - __builtin_clzll(n)); i; i >>= 1) {
+        /* F(2i) = F(i) * [ 2 * F(i+1) – F(i) ] */
+        u64 c = mulmod(a, addmod(addmod(b, b, m), m - a, m), m);
+        /* F(2i+1) = F(i)^2 + F(i+1)^2 */
+        u64 d = addmod(mulmod(a, a, m), mulmod(b, b, m), m);
+        if (n & i) {
+            a = d;
+            b = addmod(c, d, m);
+        } else {
+            a = c;
+            b = d;
+        }
+    }
+    *value = a;
+    *len = k;
+    return 0;
+}
+
+#endif /* FIBDIGITS_H */
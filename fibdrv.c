@@ -1,14 +1,27 @@
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
+#include <linux/err.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/kdev_t.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/string.h>
-/* #include "bn2.h" */
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
 #include "bn10.h"
+#include "bn2.h"
+#include "fibdigits.h"
+#include "fibdrv.h"
+#include "fibfs.h"
+#include "fibsmall.h"
 
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_AUTHOR("National Cheng Kung University, Taiwan");
@@ -16,110 +29,729 @@ MODULE_DESCRIPTION("Fibonacci engine driver");
 MODULE_VERSION("0.1");
 
 #define DEV_FIBONACCI_NAME "fibonacci"
+#define DEV_FIBONACCI_SEQ_NAME "fibonacci_seq"
 
 static dev_t fib_dev = 0;
 static struct cdev *fib_cdev;
+static struct cdev *fib_seq_cdev;
 static struct class *fib_class;
-static DEFINE_MUTEX(fib_mutex);
 
-static ktime_t kt;
+static int fib_check_mode(const struct fib_mode *mode)
+{
+    if (mode->backend > FIB_BACKEND_BN10 || mode->algo > FIB_ALGO_FDOUBLING ||
+        mode->format > FIB_FMT_BIN)
+        return -EINVAL;
+    if (mode->format == FIB_FMT_BIN && mode->backend == FIB_BACKEND_BN10)
+        return -EINVAL;
+    return 0;
+}
+
+/*
+ * the backend and algo parameters are checked like FIB_IOC_SET_MODE, so a
+ * new fd never starts from a mode it could not have set itself
+ */
+static int fib_param_set_mode(const char *val,
+                              const struct kernel_param *kp,
+                              unsigned int *field,
+                              struct fib_mode *mode)
+{
+    int rc = kstrtouint(val, 0, field);
+
+    if (rc < 0)
+        return rc;
+    rc = fib_check_mode(mode);
+    if (rc < 0)
+        return rc;
+    *(unsigned int *) kp->arg = *field;
+    return 0;
+}
 
-/* calc n-th Fibonacci number and save into dest */
-void bn_fib(bn *dest, unsigned int n)
+static int fib_param_set_backend(const char *val,
+                                 const struct kernel_param *kp)
 {
+    struct fib_mode mode = {0};
+
+    return fib_param_set_mode(val, kp, &mode.backend, &mode);
+}
+
+static int fib_param_set_algo(const char *val, const struct kernel_param *kp)
+{
+    struct fib_mode mode = {0};
+
+    return fib_param_set_mode(val, kp, &mode.algo, &mode);
+}
+
+static const struct kernel_param_ops fib_backend_param_ops = {
+    .set = fib_param_set_backend,
+    .get = param_get_uint,
+};
+
+static const struct kernel_param_ops fib_algo_param_ops = {
+    .set = fib_param_set_algo,
+    .get = param_get_uint,
+};
+
+static unsigned int default_backend = FIB_BACKEND_AUTO;
+module_param_cb(backend, &fib_backend_param_ops, &default_backend, 0644);
+MODULE_PARM_DESC(backend, "backend of newly opened fds: 0=auto, 1=bn2, 2=bn10");
+
+static unsigned int default_algo = FIB_ALGO_AUTO;
+module_param_cb(algo, &fib_algo_param_ops, &default_algo, 0644);
+MODULE_PARM_DESC(algo,
+                 "algorithm of newly opened fds: 0=auto, 1=iter, 2=fdoubling");
+
+/*
+ * crossovers of the auto mode, measured with both backends on x86-64:
+ * n - 1 additions beat fast doubling up to n ~= 50 in either backend;
+ * bn10 renders decimal almost for free, but bn2 multiplies about twice as
+ * fast, which outweighs its divide and conquer conversion above n ~= 300
+ */
+static unsigned int iter_max_n = 50;
+module_param(iter_max_n, uint, 0644);
+MODULE_PARM_DESC(iter_max_n, "largest n computed by iteration in auto mode");
+
+static unsigned int bn10_max_n = 300;
+module_param(bn10_max_n, uint, 0644);
+MODULE_PARM_DESC(bn10_max_n,
+                 "largest n computed in decimal by bn10 in auto mode");
+
+static bool calibrate;
+module_param(calibrate, bool, 0444);
+MODULE_PARM_DESC(calibrate, "measure iter_max_n and bn10_max_n at load time");
+
+static struct dentry *fib_debugfs;
+
+static unsigned long max_request_bytes = 64UL << 20;
+module_param(max_request_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_request_bytes,
+                 "memory cap of a single request in bytes, 0 for no cap");
+
+/*
+ * per-fd state
+ * read_iter() streams the rendered F(base), where base is the index set by
+ * the last llseek(), starting at byte f_pos - base; out caches that output
+ */
+struct fib_ctx {
+    struct fib_mode mode;
+    struct mutex lock; /* protects base and out */
+    loff_t base;
+    char *out;
+    size_t out_len;
+    size_t out_size; /* bytes of out to give back to bn_pool_put() */
+};
+
+static unsigned int time_budget_ms;
+module_param(time_budget_ms, uint, 0644);
+MODULE_PARM_DESC(time_budget_ms,
+                 "time budget of a single request in ms, 0 for no budget");
+
+/*
+ * called between the steps of the algorithms below
+ * return 0 to go on, -EINTR if the caller has been killed, -ETIMEDOUT once
+ * deadline (in jiffies, 0 for none) has passed
+ */
+static int fib_checkpoint(u64 deadline)
+{
+    int rc = bn_yield();
+
+    if (!rc && deadline && time_after64(get_jiffies_64(), deadline))
+        rc = -ETIMEDOUT;
+    return rc;
+}
+
+/*
+ * calc n-th Fibonacci number and save into dest
+ * return 0 on success, -ENOMEM, -EINTR or -ETIMEDOUT on error
+ */
+int bn_fib(const struct bn_ops *ops, bn *dest, unsigned int n, u64 deadline)
+{
+    int rc = 0;
+
     bn_resize(dest, 1);
     if (n < 2) {  // Fib(0) = 0, Fib(1) = 1
         dest->number[0] = n;
-        return;
+        return 0;
     }
 
     bn *a = bn_alloc(1);
     bn *b = bn_alloc(1);
+    if (!a || !b) {
+        rc = -ENOMEM;
+        goto out;
+    }
     dest->number[0] = 1;
 
-    for (unsigned int i = 1; i < n; i++) {
+    for (unsigned int i = 1; i < n && !rc; i++) {
+        if (!(i & 255)) {
+            rc = fib_checkpoint(deadline);
+            if (rc < 0)
+                break;
+        }
         bn_swap(b, dest);
-        bn_add(a, b, dest);
+        rc = ops->add(a, b, dest);
         bn_swap(a, b);
     }
+out:
     bn_free(a);
     bn_free(b);
+    return rc;
+}
+
+/*
+ * one bit of the fast doubling ladder: F(k), F(k+1) in a, b become
+ * F(2k + bit), F(2k + bit + 1) in c, d; a and b are left intact and t is
+ * scratch, so all five must be distinct
+ * return 0 on success, -ENOMEM or -EINTR on error
+ */
+static int bn_fib_double(const struct bn_ops *ops,
+                         const bn *a,
+                         const bn *b,
+                         bn *c,
+                         bn *d,
+                         bn *t,
+                         bool bit)
+{
+    /* c = F(2k) = F(k) * [ 2 * F(k+1) – F(k) ] */
+    int rc = ops->add(b, b, t) ?: ops->sub(t, a, t) ?: ops->mult(a, t, c);
+    /* d = F(2k+1) = F(k)^2 + F(k+1)^2 */
+    rc = rc ?: ops->mult(a, a, d) ?: ops->mult(b, b, t) ?: ops->add(d, t, d);
+    if (rc || !bit)
+        return rc;
+    /* F(2k+1), F(2k) + F(2k+1) */
+    rc = ops->add(c, d, c);
+    bn_swap(c, d);
+    return rc;
+}
+
+/*
+ * calc F(n) into f1 and F(n+1) into f2 by fast doubling
+ * every bit is computed into scratch buffers and rotated in with bn_swap(),
+ * so no limb is ever copied
+ * return 0 on success, -ENOMEM, -EINTR or -ETIMEDOUT on error
+ */
+int bn_fib_fdoubling_pair(const struct bn_ops *ops,
+                          bn *f1,
+                          bn *f2,
+                          unsigned int n,
+                          u64 deadline)
+{
+    int rc = 0;
+
+    bn *t1 = bn_alloc(1);
+    bn *t2 = bn_alloc(1);
+    bn *t3 = bn_alloc(1);
+    if (!t1 || !t2 || !t3) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    bn_resize(f1, 1);
+    bn_resize(f2, 1);
+    f1->number[0] = 0; /* F(k) */
+    f2->number[0] = 1; /* F(k+1) */
+    f1->sign = f2->sign = 0;
+
+    /* leading zero bits of n would only double F(0) */
+    for (unsigned int i = n ? 1U << (31 - __builtin_clz(n)) : 0; i && !rc;
+         i >>= 1) {
+        rc = fib_checkpoint(deadline)
+             ?: bn_fib_double(ops, f1, f2, t1, t2, t3, n & i);
+        bn_swap(f1, t1);
+        bn_swap(f2, t2);
+    }
+out:
+    bn_free(t1);
+    bn_free(t2);
+    bn_free(t3);
+    return rc;
 }
 
-void bn_fib_fdoubling(bn *dest, unsigned int n)
+/* return 0 on success, -ENOMEM, -EINTR or -ETIMEDOUT on error */
+int bn_fib_fdoubling(const struct bn_ops *ops,
+                     bn *dest,
+                     unsigned int n,
+                     u64 deadline)
 {
+    int rc;
+
     bn_resize(dest, 1);
     if (n < 2) {  // Fib(0) = 0, Fib(1) = 1
         dest->number[0] = n;
-        return;
-    }
-
-    bn *f1 = dest;        /* F(k) */
-    bn *f2 = bn_alloc(1); /* F(k+1) */
-    f1->number[0] = 0;
-    f2->number[0] = 1;
-    bn *k1 = bn_alloc(1);
-    bn *k2 = bn_alloc(1);
-
-    for (unsigned int i = 1U << 31; i; i >>= 1) {
-        /* F(2k) = F(k) * [ 2 * F(k+1) – F(k) ] */
-        bn_cpy(k1, f2);
-        bn_add(k1, k1, k1); /* bn_lshift(k1, 1); */
-        bn_sub(k1, f1, k1);
-        bn_mult(k1, f1, k1);
-        /* F(2k+1) = F(k)^2 + F(k+1)^2 */
-        bn_mult(f1, f1, f1);
-        bn_mult(f2, f2, f2);
-        bn_cpy(k2, f1);
-        bn_add(k2, f2, k2);
-        if (n & i) {
-            bn_cpy(f1, k2);
-            bn_cpy(f2, k1);
-            bn_add(f2, k2, f2);
-        } else {
-            bn_cpy(f1, k1);
-            bn_cpy(f2, k2);
-        }
+        return 0;
     }
+
+    bn *f2 = bn_alloc(1);
+    if (!f2)
+        return -ENOMEM;
+    rc = bn_fib_fdoubling_pair(ops, dest, f2, n, deadline);
     bn_free(f2);
-    bn_free(k1);
-    bn_free(k2);
+    return rc;
 }
 
-static int fib_open(struct inode *inode, struct file *file)
+/*
+ * pick the backend and the algorithm for F(n)
+ * explicit choices in mode win, AUTO falls back to the crossovers above
+ */
+static const struct bn_ops *fib_dispatch(const struct fib_mode *mode,
+                                         unsigned int n,
+                                         unsigned int *algo)
+{
+    if (mode->algo == FIB_ALGO_ITER || mode->algo == FIB_ALGO_FDOUBLING)
+        *algo = mode->algo;
+    else
+        *algo = n <= iter_max_n ? FIB_ALGO_ITER : FIB_ALGO_FDOUBLING;
+
+    switch (mode->backend) {
+    case FIB_BACKEND_BN2:
+        return &bn2_ops;
+    case FIB_BACKEND_BN10:
+        return &bn10_ops;
+    }
+    /* only bn2 holds the binary representation */
+    if (mode->format == FIB_FMT_BIN || n > bn10_max_n)
+        return &bn2_ops;
+    return &bn10_ops;
+}
+
+/* n probed by the calibration, the crossovers land on one of them */
+static const unsigned int fib_calib_n[] = {
+    8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+};
+
+/*
+ * best of three runs computing F(n), and rendering it to decimal if render
+ * return the time in ns, or -ENOMEM / -EINTR on error
+ */
+static s64 fib_calib_time(const struct bn_ops *ops,
+                          unsigned int algo,
+                          unsigned int n,
+                          bool render)
+{
+    s64 best = S64_MAX;
+
+    for (int run = 0; run < 3; run++) {
+        ktime_t t = ktime_get();
+        bn *fib = bn_alloc(1);
+        int rc;
+
+        if (!fib)
+            return -ENOMEM;
+        if (algo == FIB_ALGO_ITER)
+            rc = bn_fib(ops, fib, n, 0);
+        else
+            rc = bn_fib_fdoubling(ops, fib, n, 0);
+        if (!rc && render) {
+            size_t size;
+            char *str = ops->to_string(fib, &size);
+            if (IS_ERR(str))
+                rc = PTR_ERR(str);
+            else
+                bn_pool_put(str, size);
+        }
+        t = ktime_sub(ktime_get(), t);
+        bn_free(fib);
+        if (rc < 0)
+            return rc;
+        best = min(best, ktime_to_ns(t));
+    }
+    return best;
+}
+
+/*
+ * measure the crossovers of the auto mode on this CPU: each becomes the last
+ * probed n at which the side for small n still wins, 0 if it never does;
+ * near the crossover the two are within noise, so earlier losses are ignored
+ * return 0 on success, -ENOMEM or -EINTR on error
+ */
+static int fib_calibrate(void)
+{
+    unsigned int iter_n = 0, bn10_n = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(fib_calib_n); i++) {
+        unsigned int n = fib_calib_n[i];
+        s64 t[4] = {
+            fib_calib_time(&bn10_ops, FIB_ALGO_ITER, n, false),
+            fib_calib_time(&bn10_ops, FIB_ALGO_FDOUBLING, n, false),
+            fib_calib_time(&bn2_ops, FIB_ALGO_FDOUBLING, n, true),
+            fib_calib_time(&bn10_ops, FIB_ALGO_FDOUBLING, n, true),
+        };
+
+        for (size_t j = 0; j < ARRAY_SIZE(t); j++) {
+            if (t[j] < 0)
+                return t[j];
+        }
+        if (t[0] <= t[1])
+            iter_n = n;
+        if (t[3] <= t[2])
+            bn10_n = n;
+    }
+    /* bn10 still won at the last probe, keep it for all n */
+    if (bn10_n == fib_calib_n[ARRAY_SIZE(fib_calib_n) - 1])
+        bn10_n = UINT_MAX;
+
+    WRITE_ONCE(iter_max_n, iter_n);
+    WRITE_ONCE(bn10_max_n, bn10_n);
+    printk(KERN_INFO "fibdrv: calibrated iter_max_n=%u bn10_max_n=%u\n",
+           iter_n, bn10_n);
+    return 0;
+}
+
+/* writing anything to <debugfs>/fibdrv/calibrate reruns fib_calibrate() */
+static ssize_t fib_calibrate_write(struct file *file,
+                                   const char __user *buf,
+                                   size_t size,
+                                   loff_t *offset)
+{
+    int rc = fib_calibrate();
+
+    return rc < 0 ? rc : size;
+}
+
+static const struct file_operations fib_calibrate_fops = {
+    .owner = THIS_MODULE,
+    .write = fib_calibrate_write,
+};
+
+/*
+ * rough upper bound of the memory computing and rendering F(n) takes: either
+ * backend stores at most digits / 2 bytes per number, the algorithms keep a
+ * handful of numbers alive, and the decimal output takes digits bytes
+ */
+static u64 fib_request_bytes(u64 n)
+{
+    return 4 * fib_digits(n) + 256;
+}
+
+/*
+ * admission of a request for F(n)
+ * return -E2BIG if n does not fit the unsigned int of the backends or F(n)
+ * exceeds max_request_bytes, else 0 with the deadline of time_budget_ms in
+ * *deadline (0 for none)
+ */
+static int fib_admit(u64 n, u64 *deadline)
+{
+    if (n > UINT_MAX)
+        return -E2BIG;
+    if (max_request_bytes && fib_request_bytes(n) > max_request_bytes)
+        return -E2BIG;
+
+    *deadline = 0;
+    if (time_budget_ms)
+        *deadline = get_jiffies_64() + msecs_to_jiffies(time_budget_ms);
+    return 0;
+}
+
+/*
+ * compute F(n) with the backend and algorithm picked for this fd
+ * n is the file position on the device, so it is only narrowed once admitted
+ * return ERR_PTR(-E2BIG) if fib_admit() refuses n, or the error of the
+ * algorithm
+ */
+static bn *fib_compute(const struct fib_mode *mode,
+                       u64 n,
+                       const struct bn_ops **ops)
+{
+    unsigned int algo;
+    u64 deadline;
+    bn *fib;
+    int rc;
+
+    rc = fib_admit(n, &deadline);
+    if (rc < 0)
+        return ERR_PTR(rc);
+
+    fib = bn_alloc(1);
+    if (!fib)
+        return ERR_PTR(-ENOMEM);
+
+    *ops = fib_dispatch(mode, n, &algo);
+    if (algo == FIB_ALGO_ITER)
+        rc = bn_fib(*ops, fib, n, deadline);
+    else
+        rc = bn_fib_fdoubling(*ops, fib, n, deadline);
+    if (rc < 0) {
+        bn_free(fib);
+        return ERR_PTR(rc);
+    }
+    return fib;
+}
+
+/* fibfs_compute_t on top of fib_compute() */
+static bn *fib_compute_fibfs(const struct fib_mode *mode, unsigned int n)
+{
+    const struct bn_ops *ops;
+
+    return fib_compute(mode, n, &ops);
+}
+
+/* auto mode serves F(n) for small n from the tables of fibsmall.h */
+static bool fib_small_ok(const struct fib_mode *mode, loff_t n)
+{
+    return n >= 0 && n <= FIB_SMALL_MAX_N &&
+           mode->backend == FIB_BACKEND_AUTO && mode->algo == FIB_ALGO_AUTO;
+}
+
+/*
+ * F(n) for fib_small_ok() in the format of mode: the decimal digits, or the
+ * binary words staged in words[4]; the length in bytes goes to *len
+ */
+static const void *fib_small_output(const struct fib_mode *mode,
+                                    unsigned int n,
+                                    u32 *words,
+                                    size_t *len)
+{
+    if (mode->format == FIB_FMT_BIN) {
+        *len = fib_small_words(n, words);
+        return words;
+    }
+    *len = fib_small_len[n];
+    return fib_small_dec[n];
+}
+
+/*
+ * render F(ctx->base) into ctx->out, as a decimal line or binary words
+ * return 0 on success, a negative errno of fib_compute() on error
+ */
+static int fib_render(struct fib_ctx *ctx)
 {
-    if (!mutex_trylock(&fib_mutex)) {
-        printk(KERN_ALERT "fibdrv is in use");
-        return -EBUSY;
+    const struct bn_ops *ops;
+    char *out;
+    bn *fib;
+
+    if (ctx->out)
+        return 0;
+
+    if (fib_small_ok(&ctx->mode, ctx->base)) {
+        u32 words[4];
+        const void *src =
+            fib_small_output(&ctx->mode, ctx->base, words, &ctx->out_len);
+
+        out = bn_pool_get(ctx->out_len + 1, &ctx->out_size);
+        if (!out)
+            return -ENOMEM;
+        memcpy(out, src, ctx->out_len);
+        if (ctx->mode.format == FIB_FMT_DEC)
+            out[ctx->out_len++] = '\n';
+        ctx->out = out;
+        return 0;
+    }
+
+    fib = fib_compute(&ctx->mode, ctx->base, &ops);
+    if (IS_ERR(fib))
+        return PTR_ERR(fib);
+    if (ctx->mode.format == FIB_FMT_BIN) {
+        ctx->out_len = fib->size * sizeof(unsigned int);
+        out = bn_pool_get(ctx->out_len, &ctx->out_size);
+        if (out)
+            memcpy(out, fib->number, ctx->out_len);
+        else
+            out = ERR_PTR(-ENOMEM);
+    } else {
+        out = ops->to_string(fib, &ctx->out_size);
+        if (!IS_ERR(out)) {
+            ctx->out_len = strlen(out);
+            out[ctx->out_len++] = '\n'; /* in place of the NUL */
+        }
     }
+    bn_free(fib);
+    if (IS_ERR(out))
+        return PTR_ERR(out);
+    ctx->out = out;
+    return 0;
+}
+
+static void fib_drop_output(struct fib_ctx *ctx)
+{
+    bn_pool_put(ctx->out, ctx->out_size);
+    ctx->out = NULL;
+}
+
+static int fib_open(struct inode *inode, struct file *file)
+{
+    struct fib_ctx *ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+
+    if (!ctx)
+        return -ENOMEM;
+    ctx->mode.backend = default_backend;
+    ctx->mode.algo = default_algo;
+    ctx->mode.format = FIB_FMT_DEC;
+    mutex_init(&ctx->lock);
+    file->private_data = ctx;
     return 0;
 }
 
 static int fib_release(struct inode *inode, struct file *file)
 {
-    mutex_unlock(&fib_mutex);
+    struct fib_ctx *ctx = file->private_data;
+
+    fib_drop_output(ctx);
+    mutex_destroy(&ctx->lock);
+    kfree(ctx);
     return 0;
 }
 
+/* bytes of decimal output staged on the stack per copy_to_user() */
+#define FIB_COPY_CHUNK 256
+
+/*
+ * copy the NUL-terminated decimal string of fib to buf, truncated to size,
+ * rendering it a chunk at a time instead of building it in kernel memory
+ * return 0 on success, -EFAULT or -EINTR on error
+ */
+static int fib_copy_decimal(const struct bn_ops *ops,
+                            const bn *fib,
+                            char __user *buf,
+                            size_t size)
+{
+    char chunk[FIB_COPY_CHUNK];
+    size_t len = min(ops->str_len(fib) + 1, size);
+
+    for (size_t off = 0, n; off < len; off += n) {
+        if (bn_yield() < 0)
+            return -EINTR;
+        n = ops->render(fib, chunk, off, min(sizeof(chunk), len - off));
+        if (!n)
+            chunk[n++] = '\0';
+        if (copy_to_user(buf + off, chunk, n))
+            return -EFAULT;
+    }
+    return 0;
+}
+
+struct fib_user_sink {
+    char __user *buf;
+    size_t off, size;
+};
+
+static int fib_user_sink(void *arg, const char *s, size_t len)
+{
+    struct fib_user_sink *sink = arg;
+
+    len = min(len, sink->size - sink->off);
+    if (copy_to_user(sink->buf + sink->off, s, len))
+        return -EFAULT;
+    sink->off += len;
+    return sink->off == sink->size; /* full, stop converting */
+}
+
+/*
+ * copy the NUL-terminated decimal string of fib to buf, truncated to size,
+ * as ops->emit() converts it block by block
+ * return 0 on success, -EFAULT, -ENOMEM or -EINTR on error
+ */
+static int fib_emit_decimal(const struct bn_ops *ops,
+                            const bn *fib,
+                            char __user *buf,
+                            size_t size)
+{
+    struct fib_user_sink sink = {buf, 0, size};
+    int rc;
+
+    if (!size)
+        return 0;
+    rc = ops->emit(fib, fib_user_sink, &sink);
+    if (rc < 0)
+        return rc;
+    return fib_user_sink(&sink, "", 1) < 0 ? -EFAULT : 0;
+}
+
+/* fib_copy_decimal() or fib_emit_decimal(), whichever ops supports */
+static int fib_put_decimal(const struct bn_ops *ops,
+                           const bn *fib,
+                           char __user *buf,
+                           size_t size)
+{
+    if (ops->render)
+        return fib_copy_decimal(ops, fib, buf, size);
+    return fib_emit_decimal(ops, fib, buf, size);
+}
+
 /* calculate the fibonacci number at given offset */
 static ssize_t fib_read(struct file *file,
                         char *buf,
                         size_t size,
                         loff_t *offset)
 {
+    struct fib_ctx *ctx = file->private_data;
+    const struct bn_ops *ops;
+    struct fib_mode mode;
+    ssize_t rc = 0;
+    ktime_t kt;
+    bn *fib;
+
+    /* FIB_IOC_SET_MODE may change ctx->mode meanwhile, use one snapshot */
+    mutex_lock(&ctx->lock);
+    mode = ctx->mode;
+    mutex_unlock(&ctx->lock);
+
     kt = ktime_get();
-    bn *fib = bn_alloc(1);
-    bn_fib_fdoubling(fib, *offset);
-    /* bn_fib(fib, *offset); */
+    if (fib_small_ok(&mode, *offset)) {
+        u32 words[4];
+        size_t len;
+        const void *src = fib_small_output(&mode, *offset, words, &len);
+
+        /* the decimal string goes out with its NUL */
+        if (mode.format == FIB_FMT_DEC)
+            len++;
+        if (copy_to_user(buf, src, min(size, len)))
+            return -EFAULT;
+        goto out;
+    }
+
+    fib = fib_compute(&mode, *offset, &ops);
+    if (IS_ERR(fib))
+        return PTR_ERR(fib);
 
-    char *str = bn_to_string(fib);
-    copy_to_user(buf, str, strlen(str) + 1);
+    if (mode.format == FIB_FMT_BIN) {
+        if (copy_to_user(buf, fib->number,
+                         min(size, fib->size * sizeof(unsigned int))))
+            rc = -EFAULT;
+    } else {
+        rc = fib_put_decimal(ops, fib, buf, size);
+    }
 
     bn_free(fib);
+    if (rc < 0)
+        return rc;
+out:
     kt = ktime_sub(ktime_get(), kt);
     return ktime_to_ns(kt);
 }
 
+/*
+ * stream the rendered F(n) for splice(), sendfile() and readv()
+ * lseek(fd, n, SEEK_SET) selects n, then the output is consumed from there;
+ * read() keeps returning the whole F(f_pos) at once
+ */
+static ssize_t fib_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct fib_ctx *ctx = iocb->ki_filp->private_data;
+    ssize_t rc;
+    loff_t pos;
+
+    if (!iov_iter_count(to))
+        return 0;
+
+    mutex_lock(&ctx->lock);
+    pos = iocb->ki_pos - ctx->base;
+    if (pos < 0) {
+        rc = -EINVAL;
+        goto out;
+    }
+    rc = fib_render(ctx);
+    if (rc < 0 || pos >= ctx->out_len)
+        goto out;
+
+    rc = copy_to_iter(ctx->out + pos, ctx->out_len - pos, to);
+    if (!rc) {
+        rc = -EFAULT;
+        goto out;
+    }
+    iocb->ki_pos += rc;
+out:
+    mutex_unlock(&ctx->lock);
+    return rc;
+}
+
 /* write operation is skipped */
 static ssize_t fib_write(struct file *file,
                          const char *buf,
@@ -150,33 +782,507 @@ static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
     if (new_pos < 0)
         new_pos = 0;        // min case
     file->f_pos = new_pos;  // This is what we'll use now
+
+    struct fib_ctx *ctx = file->private_data;
+    mutex_lock(&ctx->lock);
+    if (ctx->base != new_pos)
+        fib_drop_output(ctx);
+    ctx->base = new_pos;
+    mutex_unlock(&ctx->lock);
     return new_pos;
 }
 
+/*
+ * ladder states shared by the indices of one FIB_IOC_BATCH call: slot s holds
+ * F(at[s]), F(at[s] + 1), and the next index n is reached from whichever
+ * slot is closest, by additions or by doubling the longest common prefix
+ * n >> s, so sorted indices only pay for the bits they do not share
+ */
+#define FIB_LADDER_SLOTS 33
+
+struct fib_ladder {
+    bn *f[FIB_LADDER_SLOTS][2];
+    u64 at[FIB_LADDER_SLOTS];
+    bn *t;
+};
+
+static void fib_ladder_free(struct fib_ladder *l)
+{
+    for (int s = 0; s < FIB_LADDER_SLOTS; s++) {
+        bn_free(l->f[s][0]);
+        bn_free(l->f[s][1]);
+    }
+    bn_free(l->t);
+    kfree(l);
+}
+
+/* every slot starts as F(0), F(1), the common prefix of all indices */
+static struct fib_ladder *fib_ladder_alloc(void)
+{
+    struct fib_ladder *l = kzalloc(sizeof(*l), GFP_KERNEL);
+
+    if (!l)
+        return NULL;
+    for (int s = 0; s < FIB_LADDER_SLOTS; s++) {
+        l->f[s][0] = bn_alloc(1);
+        l->f[s][1] = bn_alloc(1);
+        if (!l->f[s][0] || !l->f[s][1])
+            goto fail;
+        l->f[s][1]->number[0] = 1;
+    }
+    l->t = bn_alloc(1);
+    if (l->t)
+        return l;
+fail:
+    fib_ladder_free(l);
+    return NULL;
+}
+
+static void fib_ladder_swap(struct fib_ladder *l, int i, int j)
+{
+    SWAP(l->f[i][0], l->f[j][0]);
+    SWAP(l->f[i][1], l->f[j][1]);
+    SWAP(l->at[i], l->at[j]);
+}
+
+/*
+ * bring F(n), F(n + 1) into slot 0
+ * return 0 on success, -ENOMEM, -EINTR or -ETIMEDOUT on error
+ */
+static int fib_ladder_seek(const struct bn_ops *ops,
+                           struct fib_ladder *l,
+                           u64 n,
+                           u64 deadline)
+{
+    int rc = 0, near = -1, s;
+
+    /* a neighbour at most iter_max_n below is cheaper to walk up from */
+    for (s = 0; s < FIB_LADDER_SLOTS; s++) {
+        if (l->at[s] <= n && n - l->at[s] <= iter_max_n &&
+            (near < 0 || l->at[s] > l->at[near]))
+            near = s;
+    }
+    if (near >= 0) {
+        fib_ladder_swap(l, 0, near);
+        for (; l->at[0] < n && !rc; l->at[0]++) {
+            rc = fib_checkpoint(deadline)
+                 ?: ops->add(l->f[0][0], l->f[0][1], l->f[0][0]);
+            SWAP(l->f[0][0], l->f[0][1]);
+        }
+        return rc;
+    }
+
+    /* the longest prefix n >> s some slot holds, moved into slot s */
+    for (s = 1; s < FIB_LADDER_SLOTS; s++) {
+        int j;
+        for (j = 0; j < FIB_LADDER_SLOTS && l->at[j] != n >> s; j++)
+            ;
+        if (j < FIB_LADDER_SLOTS) {
+            fib_ladder_swap(l, s, j);
+            break;
+        }
+    }
+    /* slot 32 holds F(0) at worst, and n >> 32 is 0 */
+    for (; s > 0 && !rc; s--) {
+        rc = fib_checkpoint(deadline)
+             ?: bn_fib_double(ops, l->f[s][0], l->f[s][1], l->f[s - 1][0],
+                              l->f[s - 1][1], l->t, (n >> (s - 1)) & 1);
+        l->at[s - 1] = n >> (s - 1);
+    }
+    return rc;
+}
+
+struct fib_batch_item {
+    u32 n;
+    u32 i; /* position in fib_batch.ns */
+};
+
+static int fib_batch_cmp(const void *a, const void *b)
+{
+    const struct fib_batch_item *x = a, *y = b;
+
+    return (x->n > y->n) - (x->n < y->n);
+}
+
+/*
+ * FIB_IOC_BATCH: compute the sorted, distinct indices in turn on one
+ * fib_ladder and render each straight into the user buffer
+ * the ladder runs on the backend auto mode picks for the largest index, and
+ * indices up to FIB_SMALL_MAX_N come from the table
+ * return 0 on success, -ENOSPC if buf is too small, or another errno
+ */
+static long fib_batch(struct fib_batch __user *ubatch)
+{
+    const struct fib_mode mode = {
+        .backend = FIB_BACKEND_AUTO,
+        .algo = FIB_ALGO_AUTO,
+        .format = FIB_FMT_DEC,
+    };
+    struct fib_batch batch;
+    struct fib_batch_item *items = NULL;
+    struct fib_ladder *l = NULL;
+    u64 *offsets = NULL, deadline, len = 0;
+    const struct bn_ops *ops;
+    unsigned int algo;
+    long rc;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.count > FIB_BATCH_MAX || batch.reserved)
+        return -EINVAL;
+
+    items = kvmalloc_array(batch.count, sizeof(*items), GFP_KERNEL);
+    offsets = kvmalloc_array(batch.count, sizeof(*offsets), GFP_KERNEL);
+    if (!items || !offsets) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (u32 i = 0; i < batch.count; i++) {
+        const u32 __user *ns = u64_to_user_ptr(batch.ns);
+        if (get_user(items[i].n, ns + i)) {
+            rc = -EFAULT;
+            goto out;
+        }
+        items[i].i = i;
+    }
+    sort(items, batch.count, sizeof(*items), fib_batch_cmp, NULL);
+
+    /* lay the distinct results out in order, each with its NUL */
+    for (u32 i = 0; i < batch.count; i++) {
+        if (i && items[i].n == items[i - 1].n) {
+            offsets[items[i].i] = offsets[items[i - 1].i];
+            continue;
+        }
+        offsets[items[i].i] = len;
+        len += fib_digits(items[i].n) + 1;
+    }
+    if (len > batch.buf_len) {
+        batch.buf_len = len;
+        rc = copy_to_user(ubatch, &batch, sizeof(batch)) ? -EFAULT : -ENOSPC;
+        goto out;
+    }
+    if (!batch.count)
+        goto done;
+
+    rc = fib_admit(items[batch.count - 1].n, &deadline);
+    if (rc < 0)
+        goto out;
+    /* the ladder walks by itself, only the backend is taken */
+    ops = fib_dispatch(&mode, items[batch.count - 1].n, &algo);
+    for (u32 i = 0; i < batch.count; i++) {
+        char __user *buf = u64_to_user_ptr(batch.buf);
+        u64 off = offsets[items[i].i];
+        u32 n = items[i].n;
+
+        if (i && n == items[i - 1].n)
+            continue;
+        if (n <= FIB_SMALL_MAX_N) {
+            if (copy_to_user(buf + off, fib_small_dec[n],
+                             fib_small_len[n] + 1)) {
+                rc = -EFAULT;
+                goto out;
+            }
+            continue;
+        }
+        if (!l) {
+            l = fib_ladder_alloc();
+            if (!l) {
+                rc = -ENOMEM;
+                goto out;
+            }
+        }
+        rc = fib_ladder_seek(ops, l, n, deadline)
+             ?: fib_put_decimal(ops, l->f[0][0], buf + off,
+                                fib_digits(n) + 1);
+        if (rc < 0)
+            goto out;
+    }
+done:
+    batch.buf_len = len;
+    rc = 0;
+    if (copy_to_user(u64_to_user_ptr(batch.offsets), offsets,
+                     batch.count * sizeof(*offsets)) ||
+        copy_to_user(ubatch, &batch, sizeof(batch)))
+        rc = -EFAULT;
+out:
+    if (l)
+        fib_ladder_free(l);
+    kvfree(items);
+    kvfree(offsets);
+    return rc;
+}
+
+/* FIB_IOC_INFO: the sizes of F(info->n), from fibdigits.h */
+static void fib_info(struct fib_info *info)
+{
+    info->bits = fib_bits(info->n);
+    info->digits = fib_digits(info->n);
+    info->bn2_limbs = MAX(DIV_ROUNDUP(info->bits, 32), 1);
+    info->bn10_limbs = DIV_ROUNDUP(info->digits, MAX_DIGITS);
+    info->dec_bytes = info->digits + 1;
+    info->bin_bytes = info->bn2_limbs * sizeof(u32);
+}
+
+static long fib_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fib_ctx *ctx = file->private_data;
+    struct fib_mode mode;
+    struct fib_digits q;
+    struct fib_info info;
+    int rc;
+
+    switch (cmd) {
+    case FIB_IOC_SET_MODE:
+        if (copy_from_user(&mode, (void __user *) arg, sizeof(mode)))
+            return -EFAULT;
+        rc = fib_check_mode(&mode);
+        if (rc < 0)
+            return rc;
+        mutex_lock(&ctx->lock);
+        ctx->mode = mode;
+        fib_drop_output(ctx);
+        mutex_unlock(&ctx->lock);
+        return 0;
+    case FIB_IOC_GET_MODE:
+        mutex_lock(&ctx->lock);
+        mode = ctx->mode;
+        mutex_unlock(&ctx->lock);
+        if (copy_to_user((void __user *) arg, &mode, sizeof(mode)))
+            return -EFAULT;
+        return 0;
+    case FIB_IOC_BATCH:
+        return fib_batch((struct fib_batch __user *) arg);
+    case FIB_IOC_INFO:
+        if (copy_from_user(&info.n, (void __user *) arg, sizeof(info.n)))
+            return -EFAULT;
+        fib_info(&info);
+        if (copy_to_user((void __user *) arg, &info, sizeof(info)))
+            return -EFAULT;
+        return 0;
+    case FIB_IOC_LEADING:
+    case FIB_IOC_TRAILING:
+        break;
+    default:
+        return -ENOTTY;
+    }
+
+    if (copy_from_user(&q, (void __user *) arg, sizeof(q)))
+        return -EFAULT;
+
+    if (cmd == FIB_IOC_LEADING)
+        rc = fib_leading(q.n, q.k, &q.value, &q.len);
+    else
+        rc = fib_trailing(q.n, q.k, &q.value, &q.len);
+    if (rc < 0)
+        return rc;
+
+    if (copy_to_user((void __user *) arg, &q, sizeof(q)))
+        return -EFAULT;
+    return 0;
+}
+
 const struct file_operations fib_fops = {
     .owner = THIS_MODULE,
     .read = fib_read,
+    .read_iter = fib_read_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
     .write = fib_write,
     .open = fib_open,
     .release = fib_release,
     .llseek = fib_device_lseek,
+    .unlocked_ioctl = fib_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+/*
+ * /dev/fibonacci_seq: reads yield F(k), F(k+1), ... one decimal line each,
+ * where lseek(fd, k, SEEK_SET) picks the first term and f_pos follows the term
+ * being emitted. Terms are rolled forward with one bn10_add() each and
+ * rendered piecewise, so a read can be of any size.
+ */
+struct fib_seq {
+    struct mutex lock; /* protects everything below */
+    loff_t k;
+    bn *a, *b;       /* F(k) and F(k+1), NULL until the next read */
+    size_t line_off; /* bytes of the line of F(k) already read */
+    char *page;      /* staging buffer for copy_to_user() */
+};
+
+static void fib_seq_drop(struct fib_seq *seq)
+{
+    bn_free(seq->a);
+    bn_free(seq->b);
+    seq->a = seq->b = NULL;
+    seq->line_off = 0;
+}
+
+/* set up F(k) and F(k+1) by fast doubling */
+static int fib_seq_start(struct fib_seq *seq)
+{
+    u64 deadline;
+    int rc;
+
+    rc = fib_admit(seq->k, &deadline);
+    if (rc < 0)
+        return rc;
+
+    seq->a = bn_alloc(1);
+    seq->b = bn_alloc(1);
+    if (!seq->a || !seq->b)
+        rc = -ENOMEM;
+    else
+        rc = bn_fib_fdoubling_pair(&bn10_ops, seq->a, seq->b, seq->k, deadline);
+    if (rc < 0)
+        fib_seq_drop(seq);
+    return rc;
+}
+
+/* (F(k), F(k+1)) becomes (F(k+1), F(k+2)) */
+static int fib_seq_next(struct fib_seq *seq)
+{
+    int rc = bn10_add(seq->a, seq->b, seq->a);
+
+    SWAP(seq->a, seq->b);
+    seq->k++;
+    seq->line_off = 0;
+    if (rc < 0)
+        fib_seq_drop(seq); /* start over at F(k) on the next read */
+    return rc;
+}
+
+static int fib_seq_open(struct inode *inode, struct file *file)
+{
+    struct fib_seq *seq = kzalloc(sizeof(*seq), GFP_KERNEL);
+
+    if (!seq)
+        return -ENOMEM;
+    seq->page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!seq->page) {
+        kfree(seq);
+        return -ENOMEM;
+    }
+    mutex_init(&seq->lock);
+    file->private_data = seq;
+    return 0;
+}
+
+static int fib_seq_release(struct inode *inode, struct file *file)
+{
+    struct fib_seq *seq = file->private_data;
+
+    fib_seq_drop(seq);
+    mutex_destroy(&seq->lock);
+    kfree(seq->page);
+    kfree(seq);
+    return 0;
+}
+
+static ssize_t fib_seq_read(struct file *file,
+                            char __user *buf,
+                            size_t size,
+                            loff_t *offset)
+{
+    struct fib_seq *seq = file->private_data;
+    size_t done = 0;
+    int rc = 0;
+
+    if (mutex_lock_interruptible(&seq->lock))
+        return -EINTR;
+    if (!seq->a)
+        rc = fib_seq_start(seq);
+
+    while (!rc && done < size) {
+        size_t fill = 0, len = min_t(size_t, PAGE_SIZE, size - done);
+
+        while (!rc && fill < len) {
+            size_t digits = bn10_str_len(seq->a);
+            if (seq->line_off < digits) {
+                size_t n = bn10_render(seq->a, seq->page + fill, seq->line_off,
+                                       len - fill);
+                fill += n;
+                seq->line_off += n;
+            } else {
+                seq->page[fill++] = '\n';
+                rc = fib_seq_next(seq);
+            }
+        }
+        if (copy_to_user(buf + done, seq->page, fill)) {
+            rc = -EFAULT;
+            break;
+        }
+        done += fill;
+        rc = rc ?: bn_yield();
+    }
+    *offset = seq->k;
+    mutex_unlock(&seq->lock);
+    return done ? done : rc;
+}
+
+static loff_t fib_seq_lseek(struct file *file, loff_t offset, int orig)
+{
+    struct fib_seq *seq = file->private_data;
+    loff_t new_pos;
+
+    mutex_lock(&seq->lock);
+    switch (orig) {
+    case SEEK_SET:
+        new_pos = offset;
+        break;
+    case SEEK_CUR:
+        new_pos = seq->k + offset;
+        break;
+    default:
+        new_pos = -EINVAL;
+        goto out;
+    }
+
+    if (new_pos < 0 || new_pos > UINT_MAX) {
+        new_pos = -EINVAL;
+    } else if (new_pos != seq->k) {
+        fib_seq_drop(seq);
+        seq->k = new_pos;
+        file->f_pos = new_pos;
+    } else {
+        /* F(k) is kept, but its line starts over */
+        seq->line_off = 0;
+    }
+out:
+    mutex_unlock(&seq->lock);
+    return new_pos;
+}
+
+const struct file_operations fib_seq_fops = {
+    .owner = THIS_MODULE,
+    .read = fib_seq_read,
+    .open = fib_seq_open,
+    .release = fib_seq_release,
+    .llseek = fib_seq_lseek,
 };
 
 static int __init init_fib_dev(void)
 {
     int rc = 0;
 
-    mutex_init(&fib_mutex);
+    fib_small_init();
+    rc = bn_pool_init();
+    if (rc < 0)
+        return rc;
+    if (calibrate && fib_calibrate() < 0)
+        printk(KERN_WARNING "fibdrv: calibration failed, keeping defaults");
 
     // Let's register the device
     // This will dynamically allocate the major number
-    rc = alloc_chrdev_region(&fib_dev, 0, 1, DEV_FIBONACCI_NAME);
+    rc = alloc_chrdev_region(&fib_dev, 0, 2, DEV_FIBONACCI_NAME);
 
     if (rc < 0) {
         printk(KERN_ALERT
                "Failed to register the fibonacci char device. rc = %i",
                rc);
-        return rc;
+        goto failed_chrdev;
     }
 
     fib_cdev = cdev_alloc();
@@ -194,7 +1300,26 @@ static int __init init_fib_dev(void)
         goto failed_cdev;
     }
 
+    fib_seq_cdev = cdev_alloc();
+    if (fib_seq_cdev == NULL) {
+        printk(KERN_ALERT "Failed to alloc cdev");
+        rc = -1;
+        goto failed_seq_cdev;
+    }
+    fib_seq_cdev->ops = &fib_seq_fops;
+    rc = cdev_add(fib_seq_cdev, MKDEV(MAJOR(fib_dev), 1), 1);
+
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to add cdev");
+        rc = -2;
+        goto failed_seq_cdev;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    fib_class = class_create(DEV_FIBONACCI_NAME);
+#else
     fib_class = class_create(THIS_MODULE, DEV_FIBONACCI_NAME);
+#endif
 
     if (!fib_class) {
         printk(KERN_ALERT "Failed to create device class");
@@ -207,23 +1332,53 @@ static int __init init_fib_dev(void)
         rc = -4;
         goto failed_device_create;
     }
+
+    if (!device_create(fib_class, NULL, MKDEV(MAJOR(fib_dev), 1), NULL,
+                       DEV_FIBONACCI_SEQ_NAME)) {
+        printk(KERN_ALERT "Failed to create device");
+        rc = -4;
+        goto failed_seq_device_create;
+    }
+
+    rc = fibfs_register(fib_compute_fibfs);
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to register fibfs");
+        goto failed_fibfs;
+    }
+
+    /* debugfs is optional, its errors are ignored */
+    fib_debugfs = debugfs_create_dir(DEV_FIBONACCI_NAME, NULL);
+    debugfs_create_file("calibrate", 0200, fib_debugfs, NULL,
+                        &fib_calibrate_fops);
     return rc;
+failed_fibfs:
+    device_destroy(fib_class, MKDEV(MAJOR(fib_dev), 1));
+failed_seq_device_create:
+    device_destroy(fib_class, fib_dev);
 failed_device_create:
     class_destroy(fib_class);
 failed_class_create:
+    cdev_del(fib_seq_cdev);
+failed_seq_cdev:
     cdev_del(fib_cdev);
 failed_cdev:
-    unregister_chrdev_region(fib_dev, 1);
+    unregister_chrdev_region(fib_dev, 2);
+failed_chrdev:
+    bn_pool_exit();
     return rc;
 }
 
 static void __exit exit_fib_dev(void)
 {
-    mutex_destroy(&fib_mutex);
+    debugfs_remove_recursive(fib_debugfs);
+    fibfs_unregister();
+    device_destroy(fib_class, MKDEV(MAJOR(fib_dev), 1));
     device_destroy(fib_class, fib_dev);
     class_destroy(fib_class);
+    cdev_del(fib_seq_cdev);
     cdev_del(fib_cdev);
-    unregister_chrdev_region(fib_dev, 1);
+    unregister_chrdev_region(fib_dev, 2);
+    bn_pool_exit();
 }
 
 module_init(init_fib_dev);
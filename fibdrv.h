@@ -0,0 +1,92 @@
+#ifndef FIBDRV_H
+#define FIBDRV_H
+
+/*
+ * ioctl interface of /dev/fibonacci, shared by the driver and the clients
+ */
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FIB_IOC_MAGIC 'f'
+
+/* at most this many digits fit in fib_digits.value */
+#define FIB_DIGITS_MAX 18
+
+/*
+ * first or last k decimal digits of F(n)
+ * len is set to min(k, number of digits of F(n)), and value holds those len
+ * digits; print trailing digits with "%0*llu" to keep the leading zeros
+ */
+struct fib_digits {
+    __u64 n;
+    __u32 k;
+    __u32 len;
+    __u64 value;
+};
+
+#define FIB_IOC_LEADING _IOWR(FIB_IOC_MAGIC, 1, struct fib_digits)
+#define FIB_IOC_TRAILING _IOWR(FIB_IOC_MAGIC, 2, struct fib_digits)
+
+/* arithmetic backend, AUTO lets the driver pick by n and format */
+#define FIB_BACKEND_AUTO 0
+#define FIB_BACKEND_BN2 1  /* limbs in radix 2^32, see bn2.h */
+#define FIB_BACKEND_BN10 2 /* limbs in radix 10^8, see bn10.h */
+
+/* algorithm computing F(n), AUTO lets the driver pick by n */
+#define FIB_ALGO_AUTO 0
+#define FIB_ALGO_ITER 1      /* n - 1 additions */
+#define FIB_ALGO_FDOUBLING 2 /* fast doubling, O(log n) multiplications */
+
+/* what read() copies out */
+#define FIB_FMT_DEC 0 /* NUL-terminated decimal string */
+#define FIB_FMT_BIN 1 /* |F(n)| as little-endian 32-bit words, bn2 only */
+
+/* per-fd settings, the defaults come from the module parameters */
+struct fib_mode {
+    __u32 backend;
+    __u32 algo;
+    __u32 format;
+};
+
+#define FIB_IOC_SET_MODE _IOW(FIB_IOC_MAGIC, 3, struct fib_mode)
+#define FIB_IOC_GET_MODE _IOR(FIB_IOC_MAGIC, 4, struct fib_mode)
+
+/* most indices one FIB_IOC_BATCH call takes */
+#define FIB_BATCH_MAX 4096
+
+/*
+ * F(n) for count arbitrary indices in one call, as decimal strings
+ * ns points to count __u32 indices in any order, offsets to count __u64 that
+ * receive where the NUL-terminated F(ns[i]) starts in buf; equal indices
+ * share one string. buf_len is set to the bytes used, or, failing with
+ * ENOSPC, to the bytes needed.
+ */
+struct fib_batch {
+    __u64 ns;      /* const __u32 * */
+    __u64 offsets; /* __u64 * */
+    __u64 buf;     /* char * */
+    __u64 buf_len;
+    __u32 count;
+    __u32 reserved; /* must be 0 */
+};
+
+#define FIB_IOC_BATCH _IOWR(FIB_IOC_MAGIC, 5, struct fib_batch)
+
+/*
+ * exact size of F(n), known in O(log n) without computing F(n)
+ * dec_bytes and bin_bytes are the buffer sizes read() needs in FIB_FMT_DEC
+ * (the digits and the NUL) and FIB_FMT_BIN
+ */
+struct fib_info {
+    __u64 n;
+    __u64 bits;       /* 0 for F(0) */
+    __u64 digits;     /* decimal digits, 1 for F(0) */
+    __u64 bn2_limbs;  /* 32-bit words, at least 1 */
+    __u64 bn10_limbs; /* radix 10^8 limbs */
+    __u64 dec_bytes;
+    __u64 bin_bytes;
+};
+
+#define FIB_IOC_INFO _IOWR(FIB_IOC_MAGIC, 6, struct fib_info)
+
+#endif /* FIBDRV_H */
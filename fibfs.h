@@ -0,0 +1,312 @@
+#ifndef FIBFS_H
+#define FIBFS_H
+
+/*
+ * fibfs: F(n) as files in a pseudo filesystem
+ *
+ *   $ sudo mount -t fibfs none /fib
+ *   $ cat /fib/100          # decimal, with a trailing newline
+ *   $ xxd /fib/100.bin      # little-endian 32-bit words, as FIB_FMT_BIN
+ *
+ * Files appear on lookup, with i_size known in O(log n) from fibdigits.h;
+ * F(n) is only computed when the first page is read and then lives in the
+ * page cache, so read(), mmap(), sendfile() and readahead all go through the
+ * generic file code, and cold results are evicted with their inodes.
+ */
+#include <linux/ctype.h>
+#include <linux/fs.h>
+#include <linux/fs_context.h>
+#include <linux/highmem.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+#include "bn10.h"
+#include "fibdigits.h"
+#include "fibdrv.h"
+
+#define FIBFS_MAGIC 0x46494246 /* "FIBF" */
+#define FIBFS_BIN_SUFFIX ".bin"
+
+/* compute F(n) as mode says, return the bn or an ERR_PTR() */
+typedef bn *(*fibfs_compute_t)(const struct fib_mode *mode, unsigned int n);
+
+static fibfs_compute_t fibfs_compute;
+
+/* i_private of a file */
+struct fibfs_entry {
+    struct mutex lock; /* protects fib */
+    unsigned int n;
+    bool bin;
+    bn *fib; /* NULL until the first page is read */
+};
+
+/*
+ * the name of a file is n or n.bin, n only digits and without leading zeros,
+ * so every file has one name: kstrtouint() alone would take "+5" and "5\n"
+ */
+static int fibfs_parse(const struct qstr *name, unsigned int *n, bool *bin)
+{
+    size_t suffix = strlen(FIBFS_BIN_SUFFIX);
+    size_t len = name->len;
+    char buf[16];
+
+    *bin = len > suffix &&
+           !memcmp(name->name + len - suffix, FIBFS_BIN_SUFFIX, suffix);
+    if (*bin)
+        len -= suffix;
+    if (!len || len >= sizeof(buf) || (name->name[0] == '0' && len > 1))
+        return -ENOENT;
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit(name->name[i]))
+            return -ENOENT;
+    }
+    memcpy(buf, name->name, len);
+    buf[len] = '\0';
+    return kstrtouint(buf, 10, n) ? -ENOENT : 0;
+}
+
+/* bytes of /fib/n: the digits and a newline, or the bn2 words */
+static loff_t fibfs_size(unsigned int n, bool bin)
+{
+    if (bin)
+        return sizeof(unsigned int) * MAX(DIV_ROUNDUP(fib_bits(n), 32), 1);
+    return fib_digits(n) + 1;
+}
+
+/* bytes [off, off + len) of the file of e into dst, zero past its end */
+static void fibfs_fill(const struct fibfs_entry *e,
+                       char *dst,
+                       loff_t off,
+                       size_t len)
+{
+    loff_t size = fibfs_size(e->n, e->bin);
+    size_t done = 0;
+
+    if (off < size) {
+        done = min_t(loff_t, len, size - off);
+        if (e->bin) {
+            memcpy(dst, (const char *) e->fib->number + off, done);
+        } else {
+            size_t n = bn10_render(e->fib, dst, off, done);
+            if (n < done)
+                dst[n] = '\n';
+        }
+    }
+    memset(dst + done, 0, len - done);
+}
+
+static int fibfs_fill_page(struct page *page)
+{
+    struct fibfs_entry *e = page->mapping->host->i_private;
+    struct fib_mode mode = {
+        .backend = e->bin ? FIB_BACKEND_BN2 : FIB_BACKEND_BN10,
+        .algo = FIB_ALGO_AUTO,
+        .format = e->bin ? FIB_FMT_BIN : FIB_FMT_DEC,
+    };
+    int rc = 0;
+
+    mutex_lock(&e->lock);
+    if (!e->fib) {
+        bn *fib = fibfs_compute(&mode, e->n);
+        if (IS_ERR(fib))
+            rc = PTR_ERR(fib);
+        else
+            e->fib = fib;
+    }
+    if (!rc) {
+        char *dst = kmap(page);
+        fibfs_fill(e, dst, page_offset(page), PAGE_SIZE);
+        flush_dcache_page(page);
+        kunmap(page);
+        SetPageUptodate(page);
+    }
+    mutex_unlock(&e->lock);
+    unlock_page(page);
+    return rc;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+static int fibfs_read_folio(struct file *file, struct folio *folio)
+{
+    /* no large folios are enabled on the mapping, so this is one page */
+    return fibfs_fill_page(&folio->page);
+}
+#else
+static int fibfs_readpage(struct file *file, struct page *page)
+{
+    return fibfs_fill_page(page);
+}
+#endif
+
+static const struct address_space_operations fibfs_aops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+    .read_folio = fibfs_read_folio,
+#else
+    .readpage = fibfs_readpage,
+#endif
+};
+
+static const struct file_operations fibfs_file_ops = {
+    .owner = THIS_MODULE,
+    .llseek = generic_file_llseek,
+    .read_iter = generic_file_read_iter,
+    .mmap = generic_file_readonly_mmap,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = filemap_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+};
+
+static struct inode *fibfs_new_inode(struct super_block *sb, umode_t mode)
+{
+    struct inode *inode = new_inode(sb);
+
+    if (!inode)
+        return NULL;
+    inode->i_mode = mode;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    simple_inode_init_ts(inode);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+    inode->i_atime = inode->i_mtime = inode_set_ctime_current(inode);
+#else
+    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+#endif
+    return inode;
+}
+
+static struct dentry *fibfs_lookup(struct inode *dir,
+                                   struct dentry *dentry,
+                                   unsigned int flags)
+{
+    struct fibfs_entry *e;
+    struct inode *inode;
+    unsigned int n;
+    bool bin;
+
+    /* anything else stays a negative dentry, hence ENOENT */
+    if (fibfs_parse(&dentry->d_name, &n, &bin) < 0)
+        return d_splice_alias(NULL, dentry);
+
+    e = kzalloc(sizeof(*e), GFP_KERNEL);
+    inode = fibfs_new_inode(dir->i_sb, S_IFREG | 0444);
+    if (!e || !inode) {
+        kfree(e);
+        if (inode)
+            iput(inode);
+        return ERR_PTR(-ENOMEM);
+    }
+    mutex_init(&e->lock);
+    e->n = n;
+    e->bin = bin;
+
+    /* the root is inode 1 */
+    inode->i_ino = 2 + 2 * (u64) n + bin;
+    inode->i_size = fibfs_size(n, bin);
+    inode->i_fop = &fibfs_file_ops;
+    inode->i_mapping->a_ops = &fibfs_aops;
+    inode->i_private = e;
+    return d_splice_alias(inode, dentry);
+}
+
+static const struct inode_operations fibfs_dir_inode_ops = {
+    .lookup = fibfs_lookup,
+};
+
+/*
+ * only "." and "..": dcache_readdir() would list whichever files happen to
+ * have been looked up and are still cached
+ */
+static int fibfs_readdir(struct file *file, struct dir_context *ctx)
+{
+    dir_emit_dots(file, ctx);
+    return 0;
+}
+
+static const struct file_operations fibfs_dir_ops = {
+    .llseek = generic_file_llseek,
+    .read = generic_read_dir,
+    .iterate_shared = fibfs_readdir,
+    .fsync = noop_fsync,
+};
+
+/* drops the page cache and F(n) of a file together */
+static void fibfs_evict_inode(struct inode *inode)
+{
+    struct fibfs_entry *e = inode->i_private;
+
+    truncate_inode_pages_final(&inode->i_data);
+    clear_inode(inode);
+    if (e) {
+        bn_free(e->fib);
+        mutex_destroy(&e->lock);
+        kfree(e);
+    }
+}
+
+static const struct super_operations fibfs_super_ops = {
+    .statfs = simple_statfs,
+    .evict_inode = fibfs_evict_inode,
+};
+
+static int fibfs_fill_super(struct super_block *sb, struct fs_context *fc)
+{
+    struct inode *root;
+
+    sb->s_blocksize = PAGE_SIZE;
+    sb->s_blocksize_bits = PAGE_SHIFT;
+    sb->s_magic = FIBFS_MAGIC;
+    sb->s_op = &fibfs_super_ops;
+    sb->s_time_gran = 1;
+
+    /* the directory lists nothing, its files come from fibfs_lookup() */
+    root = fibfs_new_inode(sb, S_IFDIR | 0555);
+    if (!root)
+        return -ENOMEM;
+    root->i_ino = 1;
+    root->i_op = &fibfs_dir_inode_ops;
+    root->i_fop = &fibfs_dir_ops;
+    set_nlink(root, 2);
+    sb->s_root = d_make_root(root);
+    return sb->s_root ? 0 : -ENOMEM;
+}
+
+static int fibfs_get_tree(struct fs_context *fc)
+{
+    return get_tree_nodev(fc, fibfs_fill_super);
+}
+
+static const struct fs_context_operations fibfs_context_ops = {
+    .get_tree = fibfs_get_tree,
+};
+
+static int fibfs_init_fs_context(struct fs_context *fc)
+{
+    fc->ops = &fibfs_context_ops;
+    return 0;
+}
+
+static struct file_system_type fibfs_type = {
+    .owner = THIS_MODULE,
+    .name = "fibfs",
+    .init_fs_context = fibfs_init_fs_context,
+    .kill_sb = kill_anon_super,
+};
+
+int fibfs_register(fibfs_compute_t compute)
+{
+    fibfs_compute = compute;
+    return register_filesystem(&fibfs_type);
+}
+
+void fibfs_unregister(void)
+{
+    unregister_filesystem(&fibfs_type);
+}
+
+#endif /* FIBFS_H */
@@ -0,0 +1,72 @@
+#ifndef FIBSMALL_H
+#define FIBSMALL_H
+
+#include <linux/cache.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+
+/*
+ * F(0) .. F(186) fit in unsigned __int128: they are computed and rendered
+ * once at module init, so requests in this range never touch the bn engine
+ */
+#define FIB_SMALL_MAX_N 186
+/* F(186) has 39 digits, plus the NUL */
+#define FIB_SMALL_DIGITS 40
+
+static unsigned __int128 fib_small[FIB_SMALL_MAX_N + 1] __ro_after_init;
+static char fib_small_dec[FIB_SMALL_MAX_N + 1][FIB_SMALL_DIGITS]
+    __ro_after_init;
+static u8 fib_small_len[FIB_SMALL_MAX_N + 1] __ro_after_init;
+
+/*
+ * x in decimal into s with a trailing NUL, return the number of digits
+ * divides 32-bit words by 10, as the kernel has no 128-bit division
+ */
+static size_t __init fib_small_format(unsigned __int128 x, char *s)
+{
+    u32 w[4] = {x, x >> 32, x >> 64, x >> 96};
+    size_t len = 0;
+
+    do {
+        u32 rem = 0;
+        for (int i = 3; i >= 0; i--)
+            w[i] = div_u64_rem((u64) rem << 32 | w[i], 10, &rem);
+        s[len++] = '0' + rem;
+    } while (w[0] | w[1] | w[2] | w[3]);
+    s[len] = '\0';
+
+    for (size_t i = 0; i < len / 2; i++) {
+        char c = s[i];
+        s[i] = s[len - 1 - i];
+        s[len - 1 - i] = c;
+    }
+    return len;
+}
+
+static void __init fib_small_init(void)
+{
+    for (unsigned int n = 0; n <= FIB_SMALL_MAX_N; n++) {
+        fib_small[n] = n < 2 ? n : fib_small[n - 1] + fib_small[n - 2];
+        fib_small_len[n] = fib_small_format(fib_small[n], fib_small_dec[n]);
+    }
+}
+
+/*
+ * F(n) in the 32-bit words bn2 would hold, least significant first and at
+ * least one; return the number of bytes
+ */
+static size_t fib_small_words(unsigned int n, u32 *words)
+{
+    unsigned __int128 x = fib_small[n];
+    size_t i = 0;
+
+    do {
+        words[i++] = x;
+        x >>= 32;
+    } while (x);
+    return i * sizeof(u32);
+}
+
+#endif /* FIBSMALL_H */
@@ -26,3 +26,69 @@ for i in dics:
         print('input: %s' %(fib))
         print('expected: %s' %(expect[i[0]]))
         exit()
+
+# "./client full" results, see full_check() in client.c
+import sys
+
+if hasattr(sys, 'set_int_max_str_digits'):
+    sys.set_int_max_str_digits(0)
+
+
+def fib(n):
+    # F(n), F(n + 1) by fast doubling
+    if n == 0:
+        return 0, 1
+    a, b = fib(n >> 1)
+    c = a * (2 * b - a)
+    d = a * a + b * b
+    return (d, c + d) if n & 1 else (c, d)
+
+
+def words(hexs):
+    return int(hexs, 16) if hexs else 0
+
+
+def check(ok, line):
+    if not ok:
+        print('fail: %s' % line.rstrip())
+        sys.exit(1)
+
+
+counts = {}
+with open('out_full', 'r') as f:
+    for line in f:
+        w = line.split()
+        kind = w[0]
+        counts[kind] = counts.get(kind, 0) + 1
+        if kind == 'mode':
+            check(int(w[4]) == fib(int(w[3]))[0], line)
+        elif kind == 'info':
+            n, bits, digits, l2, l10, dec, binb, dec_len = map(int, w[1:9])
+            x = fib(n)[0]
+            check(bits == x.bit_length(), line)
+            check(digits == len(str(x)), line)
+            check(l2 == max(1, -(-bits // 32)), line)
+            check(l10 == -(-digits // 8), line)
+            check(dec == digits + 1 and dec_len == dec, line)
+            check(binb == 4 * l2 and len(w[9]) == 2 * binb, line)
+            check(words(w[9]) == x and w[10] == '0', line)
+        elif kind in ('lead', 'trail'):
+            n, k = int(w[1]), int(w[2])
+            s = str(fib(n)[0])
+            check(w[3] == (s[:k] if kind == 'lead' else s[-k:]), line)
+        elif kind == 'batch' or kind == 'seq':
+            check(int(w[2]) == fib(int(w[1]))[0], line)
+        elif kind == 'fibfs':
+            x = fib(int(w[1]))[0]
+            check(w[3] == str(x) and int(w[2]) == len(w[3]) + 1, line)
+        elif kind == 'fibfs_bin':
+            x = fib(int(w[1]))[0]
+            check(words(w[3]) == x and int(w[2]) == len(w[3]) // 2, line)
+            check(int(w[2]) == 4 * max(1, -(-x.bit_length() // 32)), line)
+        else:
+            check(False, line)
+
+# every kind of check must have run
+for kind in ('mode', 'info', 'lead', 'trail', 'batch', 'seq', 'fibfs',
+             'fibfs_bin'):
+    check(counts.get(kind, 0) > 0, 'no %s results' % kind)
@@ -2,19 +2,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define FIB_DEV "/dev/fibonacci"
+#include "fibdrv.h"
 
-#define LOGPHI (20898764025)
-#define LOGSQRT5 (34948500216)
-#define SCALE (100000000000)
+#define FIB_DEV "/dev/fibonacci"
 
-size_t cal_buf_size(int n)
+/* exact bytes read() returns for F(n), the digits and the NUL */
+size_t cal_buf_size(int fd, int n)
 {
-    size_t digits = (n * LOGPHI - LOGSQRT5) / SCALE;
-    return digits + 2;
+    struct fib_info info = {.n = n};
+
+    if (ioctl(fd, FIB_IOC_INFO, &info) < 0) {
+        perror("Failed to query the size");
+        exit(1);
+    }
+    return info.dec_bytes;
 }
 
 int main(int argc, char const *argv[])
@@ -30,7 +35,21 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
-    size_t size = cal_buf_size(offset);
+    /* ./test n lead|trail k: only the first or last k digits */
+    if (argc == 4) {
+        struct fib_digits q = {.n = strtoull(argv[1], NULL, 10),
+                              .k = atoi(argv[3])};
+        unsigned long cmd =
+            strcmp(argv[2], "lead") ? FIB_IOC_TRAILING : FIB_IOC_LEADING;
+        if (ioctl(fd, cmd, &q) < 0) {
+            perror("Failed to query digits");
+            exit(1);
+        }
+        printf("%0*llu\n", q.len, (unsigned long long) q.value);
+        return 0;
+    }
+
+    size_t size = cal_buf_size(fd, offset);
     buf = malloc(size);
     lseek(fd, offset, SEEK_SET);
     read(fd, buf, size);